@@ -0,0 +1,131 @@
+#include "assembler.h"
+
+#include <math.h>
+
+FramesetAssembler::FramesetAssembler(Policy policy, double tolerance, double max_wait) {
+	m_policy = policy;
+	m_tolerance = tolerance;
+	m_max_wait = max_wait;
+	m_depth_latest = -1.0e300;
+	m_color_latest = -1.0e300;
+	m_complete = 0;
+	m_partial = 0;
+	m_misses = 0;
+}
+
+void FramesetAssembler::push(const rs2::frame& f, double host_time) {
+	rs2_stream type = f.get_profile().stream_type();
+	bool is_depth = type == RS2_STREAM_DEPTH;
+
+	if (!is_depth && type != RS2_STREAM_COLOR) {
+		return;
+	}
+
+	Pending p;
+	p.frame = f;
+	p.timestamp = host_time;
+
+	std::deque<Pending>& mine = is_depth ? m_depth : m_color;
+	std::deque<Pending>& other = is_depth ? m_color : m_depth;
+
+	if (is_depth) {
+		m_depth_latest = p.timestamp;
+	} else {
+		m_color_latest = p.timestamp;
+	}
+
+	mine.push_back(p);
+	match(mine, other, is_depth);
+
+	// The other stream cannot deliver anything older than its latest frame anymore
+	expire(m_depth, m_color_latest, true);
+	expire(m_color, m_depth_latest, false);
+}
+
+/**
+ * Pair the newest frame of mine with the closest pending frame in other
+ */
+void FramesetAssembler::match(std::deque<Pending>& mine, std::deque<Pending>& other, bool is_depth) {
+	const Pending& p = mine.back();
+	int best = -1;
+	double best_dt = m_tolerance;
+
+	for (size_t i = 0; i < other.size(); i++) {
+		double dt = fabs(other[i].timestamp - p.timestamp);
+		if (dt <= best_dt) {
+			best = (int)i;
+			best_dt = dt;
+		}
+	}
+
+	if (best < 0) {
+		return;
+	}
+
+	// anything in other older than the partner will never be paired
+	while (best > 0) {
+		emit_alone(other.front(), !is_depth);
+		other.pop_front();
+		best--;
+	}
+
+	Set set;
+	set.depth = is_depth ? p.frame : other.front().frame;
+	set.color = is_depth ? other.front().frame : p.frame;
+	set.depth_host_time = is_depth ? p.timestamp : other.front().timestamp;
+	set.color_host_time = is_depth ? other.front().timestamp : p.timestamp;
+	set.timestamp = p.timestamp;
+
+	other.pop_front();
+	mine.pop_back();
+	m_ready.push_back(set);
+	m_complete++;
+}
+
+void FramesetAssembler::expire(std::deque<Pending>& q, double other_latest, bool is_depth) {
+	double latest = is_depth ? m_depth_latest : m_color_latest;
+
+	while (!q.empty()) {
+		const Pending& p = q.front();
+
+		if (other_latest <= p.timestamp + m_tolerance && latest - p.timestamp <= m_max_wait) {
+			break;
+		}
+
+		emit_alone(p, is_depth);
+		q.pop_front();
+	}
+}
+
+void FramesetAssembler::emit_alone(const Pending& p, bool is_depth) {
+	m_misses++;
+
+	if (m_policy != EMIT_PARTIAL) {
+		return;
+	}
+
+	Set set;
+	set.depth_host_time = 0.0;
+	set.color_host_time = 0.0;
+	if (is_depth) {
+		set.depth = p.frame;
+		set.depth_host_time = p.timestamp;
+	} else {
+		set.color = p.frame;
+		set.color_host_time = p.timestamp;
+	}
+	set.timestamp = p.timestamp;
+
+	m_ready.push_back(set);
+	m_partial++;
+}
+
+bool FramesetAssembler::pop(Set& set) {
+	if (m_ready.empty()) {
+		return false;
+	}
+
+	set = m_ready.front();
+	m_ready.pop_front();
+	return true;
+}
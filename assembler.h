@@ -0,0 +1,82 @@
+#ifndef ASSEMBLER_H__
+#define ASSEMBLER_H__
+
+#include <stdint.h>
+#include <deque>
+
+#include <librealsense2/rs.hpp>
+
+/**
+ * Pairs individual depth and color frames by host time.
+ *
+ * Frames are pushed one at a time, in arrival order per stream. A frame is
+ * paired with the pending frame of the other stream closest in time, if they
+ * are at most m_tolerance apart. A frame that can no longer be paired - the
+ * other stream has moved past it, or it has waited longer than m_max_wait -
+ * counts as a pairing miss and is emitted alone or dropped, depending on the
+ * policy.
+ *
+ * Times are host times in ms, mapped from each sensor's hardware clock with
+ * a ClockSync, as the depth and color sensors do not share one.
+ */
+class FramesetAssembler {
+public:
+	enum Policy {
+		// Only complete depth + color pairs
+		EMIT_COMPLETE,
+		// Frames without a partner are emitted alone
+		EMIT_PARTIAL
+	};
+
+	struct Set {
+		rs2::frame depth;
+		rs2::frame color;
+		double depth_host_time;
+		double color_host_time;
+
+		// host time of the set: of the frame completing it, or of a lone frame
+		double timestamp;
+	};
+
+	FramesetAssembler(Policy policy, double tolerance, double max_wait);
+
+	/**
+	 * Queue a depth or color frame with its host time. Other streams are ignored.
+	 */
+	void push(const rs2::frame& f, double host_time);
+
+	/**
+	 * Next assembled set, oldest first. Returns false if none is ready.
+	 */
+	bool pop(Set& set);
+
+	uint64_t complete() const { return m_complete; }
+	uint64_t partial() const { return m_partial; }
+	uint64_t misses() const { return m_misses; }
+
+	Policy m_policy;
+	double m_tolerance;
+	double m_max_wait;
+
+private:
+	struct Pending {
+		rs2::frame frame;
+		double timestamp;
+	};
+
+	void match(std::deque<Pending>& mine, std::deque<Pending>& other, bool is_depth);
+	void expire(std::deque<Pending>& q, double other_latest, bool is_depth);
+	void emit_alone(const Pending& p, bool is_depth);
+
+	std::deque<Pending> m_depth;
+	std::deque<Pending> m_color;
+	double m_depth_latest;
+	double m_color_latest;
+	std::deque<Set> m_ready;
+
+	uint64_t m_complete;
+	uint64_t m_partial;
+	uint64_t m_misses;
+};
+
+#endif // ASSEMBLER_H__
@@ -0,0 +1,176 @@
+#include "background.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BACKGROUND_USE_SSE2 1
+#endif
+
+static inline int popcount16(unsigned int v) {
+	v = v - ((v >> 1) & 0x5555);
+	v = (v & 0x3333) + ((v >> 2) & 0x3333);
+	v = (v + (v >> 4)) & 0x0f0f;
+	return (v + (v >> 8)) & 0x1f;
+}
+
+static inline uint16_t absdiff_u16(uint16_t a, uint16_t b) {
+	return a > b ? a - b : b - a;
+}
+
+BackgroundModel::BackgroundModel(int w, int h) {
+	m_w = w;
+	m_h = h;
+	m_bg.resize(w * h);
+	m_mask.resize(w * h);
+
+	m_min_band = 20;
+	m_band_shift = 5;
+	m_step = 2;
+	m_change_threshold = 200;
+	m_full_update_interval = 15;
+
+	reset();
+}
+
+void BackgroundModel::reset() {
+	memset(m_bg.data(), 0, m_bg.size() * sizeof(uint16_t));
+	memset(m_mask.data(), 0, m_mask.size());
+	m_fg_pixels = 0;
+	m_flipped_pixels = 0;
+	m_scene_changed = true;
+	m_frames_since_full = 0;
+}
+
+/**
+ * Classify and update n consecutive pixels. Adds the amount of foreground pixels
+ * before and after the update to fg_old / fg_new, and mask flips to flipped.
+ */
+void BackgroundModel::update_span(uint16_t* bg, uint8_t* mask, const uint16_t* depth, int n,
+	int& fg_old, int& fg_new, int& flipped) const
+{
+	int i = 0;
+
+#ifdef BACKGROUND_USE_SSE2
+	// SSE2 has no unsigned 16 bit compare / min / max, so everything below is
+	// built from saturating subtractions: subs(a, b) == 0 <=> a <= b
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i min_band = _mm_set1_epi16((short)m_min_band);
+	const __m128i step = _mm_set1_epi16((short)m_step);
+	const __m128i shift = _mm_cvtsi32_si128(m_band_shift);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i d = _mm_loadu_si128((const __m128i*)(depth + i));
+		__m128i b = _mm_loadu_si128((const __m128i*)(bg + i));
+		__m128i old_mask = _mm_loadl_epi64((const __m128i*)(mask + i));
+
+		__m128i d_invalid = _mm_cmpeq_epi16(d, zero);
+		__m128i b_invalid = _mm_cmpeq_epi16(b, zero);
+
+		// band = max(bg >> shift, min_band)
+		__m128i band = _mm_srl_epi16(b, shift);
+		band = _mm_adds_epu16(_mm_subs_epu16(band, min_band), min_band);
+
+		__m128i up = _mm_subs_epu16(d, b);
+		__m128i down = _mm_subs_epu16(b, d);
+		__m128i diff = _mm_or_si128(up, down);
+
+		__m128i within = _mm_cmpeq_epi16(_mm_subs_epu16(diff, band), zero);
+		__m128i fg = _mm_andnot_si128(_mm_or_si128(within, _mm_or_si128(d_invalid, b_invalid)),
+			_mm_set1_epi16(-1));
+
+		// move background towards the measurement by at most step
+		up = _mm_sub_epi16(up, _mm_subs_epu16(up, step));
+		down = _mm_sub_epi16(down, _mm_subs_epu16(down, step));
+		down = _mm_andnot_si128(d_invalid, down);
+		__m128i nb = _mm_subs_epu16(_mm_adds_epu16(b, up), down);
+
+		// unknown background takes the measurement as is
+		nb = _mm_or_si128(_mm_and_si128(b_invalid, d), _mm_andnot_si128(b_invalid, nb));
+		_mm_storeu_si128((__m128i*)(bg + i), nb);
+
+		__m128i new_mask = _mm_packs_epi16(fg, zero);
+		_mm_storel_epi64((__m128i*)(mask + i), new_mask);
+
+		fg_old += popcount16(_mm_movemask_epi8(old_mask) & 0xff);
+		fg_new += popcount16(_mm_movemask_epi8(new_mask) & 0xff);
+		flipped += popcount16(_mm_movemask_epi8(_mm_xor_si128(new_mask, old_mask)) & 0xff);
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint16_t d = depth[i];
+		uint16_t b = bg[i];
+		uint8_t m = 0;
+
+		if (d != 0 && b != 0) {
+			uint16_t band = b >> m_band_shift;
+			if (band < m_min_band) {
+				band = m_min_band;
+			}
+
+			uint16_t diff = absdiff_u16(d, b);
+			if (diff > band) {
+				m = 0xff;
+			}
+
+			if (diff > m_step) {
+				diff = m_step;
+			}
+
+			bg[i] = d > b ? b + diff : b - diff;
+		} else if (b == 0) {
+			bg[i] = d;
+		}
+
+		if (mask[i]) {
+			fg_old++;
+		}
+		if (m) {
+			fg_new++;
+		}
+		if (m != mask[i]) {
+			flipped++;
+		}
+		mask[i] = m;
+	}
+}
+
+bool BackgroundModel::update(const uint16_t* depth, const TileChangeMap* changed) {
+	int fg_old = 0;
+	int fg_new = 0;
+	int flipped = 0;
+
+	if (changed == NULL || ++m_frames_since_full >= m_full_update_interval) {
+		m_frames_since_full = 0;
+		update_span(m_bg.data(), m_mask.data(), depth, m_w * m_h, fg_old, fg_new, flipped);
+	} else {
+		// Only visit tiles whose depth changed; the rest keep their mask and model
+		const int ts = changed->tile_size();
+
+		for (int ty = 0; ty < changed->tiles_y(); ty++) {
+			int y_end = std::min((ty + 1) * ts, m_h);
+
+			for (int tx = 0; tx < changed->tiles_x(); tx++) {
+				if (!changed->changed(tx, ty)) {
+					continue;
+				}
+
+				int x0 = tx * ts;
+				int span = std::min(ts, m_w - x0);
+
+				for (int y = ty * ts; y < y_end; y++) {
+					int off = y * m_w + x0;
+					update_span(m_bg.data() + off, m_mask.data() + off, depth + off, span,
+						fg_old, fg_new, flipped);
+				}
+			}
+		}
+	}
+
+	m_fg_pixels += fg_new - fg_old;
+	m_flipped_pixels = flipped;
+	m_scene_changed = flipped > m_change_threshold;
+	return m_scene_changed;
+}
@@ -0,0 +1,76 @@
+#ifndef BACKGROUND_H__
+#define BACKGROUND_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "framechange.h"
+
+/**
+ * Per-pixel background model for depth images.
+ *
+ * Each pixel tracks an approximate running median of its depth: every frame
+ * the background value moves at most m_step depth units towards the measured
+ * value. Pixels deviating from the background by more than a noise band are
+ * marked as foreground. The band grows with distance, as stereo depth noise
+ * does: band = max(m_min_band, background >> m_band_shift).
+ *
+ * Zero depth (no data) never updates the model and is never foreground.
+ */
+class BackgroundModel {
+public:
+	BackgroundModel(int w, int h);
+
+	/**
+	 * Classify a depth frame against the model and then update the model with it.
+	 * Returns true if the foreground mask changed noticeably since the previous
+	 * frame, i.e. downstream stages have new work to do.
+	 *
+	 * If changed is given, only tiles marked as changed are processed. Skipped
+	 * tiles keep their previous mask and background values. Every
+	 * m_full_update_interval frames the whole frame is processed regardless,
+	 * so subjects that stopped moving are still absorbed into the background.
+	 */
+	bool update(const uint16_t* depth, const TileChangeMap* changed = NULL);
+
+	/**
+	 * Forget the learned background. The next frame becomes the new background.
+	 */
+	void reset();
+
+	/** Foreground mask, one byte per pixel: 0xff foreground, 0 background */
+	const uint8_t* mask() const { return m_mask.data(); }
+
+	int width() const { return m_w; }
+	int height() const { return m_h; }
+	int foreground_pixels() const { return m_fg_pixels; }
+	int flipped_pixels() const { return m_flipped_pixels; }
+	bool scene_changed() const { return m_scene_changed; }
+
+	// Tunables, in depth units (1 mm with the bundled settings JSON)
+	uint16_t m_min_band;
+	int m_band_shift;
+	uint16_t m_step;
+
+	// Amount of mask pixels that must flip between frames to report a scene change
+	int m_change_threshold;
+
+	// Frames between full updates when only changed tiles are given
+	int m_full_update_interval;
+
+private:
+	void update_span(uint16_t* bg, uint8_t* mask, const uint16_t* depth, int n,
+		int& fg_old, int& fg_new, int& flipped) const;
+
+	int m_w;
+	int m_h;
+	std::vector<uint16_t> m_bg;
+	std::vector<uint8_t> m_mask;
+	int m_fg_pixels;
+	int m_flipped_pixels;
+	bool m_scene_changed;
+	int m_frames_since_full;
+};
+
+#endif // BACKGROUND_H__
@@ -0,0 +1,223 @@
+#include "blobs.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BLOBS_USE_SSE2 1
+#endif
+
+static int find_root(std::vector<int>& parent, int i) {
+	while (parent[i] != i) {
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+static void unite(std::vector<int>& parent, int a, int b) {
+	a = find_root(parent, a);
+	b = find_root(parent, b);
+
+	// the smaller index stays root, so labels do not depend on the strip split
+	if (a < b) {
+		parent[b] = a;
+	} else if (b < a) {
+		parent[a] = b;
+	}
+}
+
+/**
+ * Joins 8-connected runs of two adjacent rows. Both rows are sorted by x,
+ * prev_base / cur_base map them to indices in parent.
+ */
+template <class RunT>
+static void join_rows(const RunT* prev, int n_prev, int prev_base,
+	const RunT* cur, int n_cur, int cur_base, std::vector<int>& parent)
+{
+	int i = 0;
+	int j = 0;
+
+	while (i < n_prev && j < n_cur) {
+		const RunT& p = prev[i];
+		const RunT& c = cur[j];
+
+		if (p.x1 + 1 < c.x0) {
+			i++;
+		} else if (c.x1 + 1 < p.x0) {
+			j++;
+		} else {
+			unite(parent, prev_base + i, cur_base + j);
+			if (p.x1 < c.x1) {
+				i++;
+			} else {
+				j++;
+			}
+		}
+	}
+}
+
+BlobExtractor::BlobExtractor(int w, int h, WorkerPool& pool) : m_pool(pool) {
+	m_w = w;
+	m_h = h;
+	m_min_pixels = 50;
+
+	int strips = std::min(pool.size() * 2, h);
+	m_strips.resize(strips);
+
+	for (int i = 0; i < strips; i++) {
+		m_strips[i].y0 = h * i / strips;
+		m_strips[i].y1 = h * (i + 1) / strips;
+	}
+}
+
+void BlobExtractor::label_strip(Strip& s, const uint8_t* mask, const uint16_t* depth) {
+	s.runs.clear();
+	s.parent.clear();
+	s.row_start.clear();
+
+	for (int y = s.y0; y < s.y1; y++) {
+		const uint8_t* row = mask + y * m_w;
+		const uint16_t* drow = depth ? depth + y * m_w : NULL;
+		int begin = (int)s.runs.size();
+		int x = 0;
+
+		s.row_start.push_back(begin);
+
+		while (x < m_w) {
+#ifdef BLOBS_USE_SSE2
+			const __m128i zero = _mm_setzero_si128();
+			while (x + 16 <= m_w &&
+				_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(row + x)), zero)) == 0xffff) {
+				x += 16;
+			}
+#endif
+			while (x < m_w && !row[x]) {
+				x++;
+			}
+
+			if (x >= m_w) {
+				break;
+			}
+
+			Run r;
+			r.x0 = x;
+			r.y = y;
+			r.pixels_valid = 0;
+			r.depth_sum = 0;
+
+			while (x < m_w && row[x]) {
+				if (drow && drow[x]) {
+					r.depth_sum += drow[x];
+					r.pixels_valid++;
+				}
+				x++;
+			}
+
+			r.x1 = x - 1;
+			s.parent.push_back((int)s.runs.size());
+			s.runs.push_back(r);
+		}
+
+		if (y > s.y0) {
+			int prev = s.row_start[s.row_start.size() - 2];
+			join_rows(s.runs.data() + prev, begin - prev, prev,
+				s.runs.data() + begin, (int)s.runs.size() - begin, begin, s.parent);
+		}
+	}
+
+	s.row_start.push_back((int)s.runs.size());
+}
+
+const std::vector<Blob>& BlobExtractor::extract(const uint8_t* mask, const uint16_t* depth) {
+	m_pool.parallel_for((int)m_strips.size(), [&](int i) {
+		label_strip(m_strips[i], mask, depth);
+	});
+
+	// Serial merge: global run indices are strip offsets plus local indices
+	std::vector<int> offsets(m_strips.size());
+	int total = 0;
+
+	for (size_t i = 0; i < m_strips.size(); i++) {
+		offsets[i] = total;
+		total += (int)m_strips[i].runs.size();
+	}
+
+	m_parent.resize(total);
+
+	for (size_t i = 0; i < m_strips.size(); i++) {
+		Strip& s = m_strips[i];
+		for (size_t r = 0; r < s.runs.size(); r++) {
+			m_parent[offsets[i] + r] = offsets[i] + find_root(s.parent, (int)r);
+		}
+	}
+
+	for (size_t i = 1; i < m_strips.size(); i++) {
+		const Strip& above = m_strips[i - 1];
+		const Strip& below = m_strips[i];
+
+		// last row of the strip above against the first row of the strip below
+		int a_begin = above.row_start[above.row_start.size() - 2];
+		int a_count = (int)above.runs.size() - a_begin;
+		int b_count = below.row_start[1];
+
+		join_rows(above.runs.data() + a_begin, a_count, offsets[i - 1] + a_begin,
+			below.runs.data(), b_count, offsets[i], m_parent);
+	}
+
+	// Accumulate statistics per root
+	m_blobs.clear();
+	m_blob_of_root.assign(total, -1);
+	std::vector<uint64_t> depth_sums;
+	std::vector<int> valid;
+
+	for (size_t i = 0; i < m_strips.size(); i++) {
+		const Strip& s = m_strips[i];
+
+		for (size_t r = 0; r < s.runs.size(); r++) {
+			const Run& run = s.runs[r];
+			int root = find_root(m_parent, offsets[i] + (int)r);
+			int b = m_blob_of_root[root];
+
+			if (b < 0) {
+				b = (int)m_blobs.size();
+				m_blob_of_root[root] = b;
+
+				Blob blob;
+				blob.min_x = run.x0;
+				blob.max_x = run.x1;
+				blob.min_y = run.y;
+				blob.max_y = run.y;
+				blob.pixels = 0;
+				blob.mean_depth = 0.0f;
+				m_blobs.push_back(blob);
+				depth_sums.push_back(0);
+				valid.push_back(0);
+			}
+
+			Blob& blob = m_blobs[b];
+			blob.min_x = std::min(blob.min_x, (int)run.x0);
+			blob.max_x = std::max(blob.max_x, (int)run.x1);
+			blob.min_y = std::min(blob.min_y, (int)run.y);
+			blob.max_y = std::max(blob.max_y, (int)run.y);
+			blob.pixels += run.x1 - run.x0 + 1;
+			depth_sums[b] += run.depth_sum;
+			valid[b] += run.pixels_valid;
+		}
+	}
+
+	for (size_t b = 0; b < m_blobs.size(); b++) {
+		if (valid[b] > 0) {
+			m_blobs[b].mean_depth = (float)((double)depth_sums[b] / valid[b]);
+		}
+	}
+
+	int min_pixels = m_min_pixels;
+	m_blobs.erase(std::remove_if(m_blobs.begin(), m_blobs.end(),
+		[min_pixels](const Blob& b) { return b.pixels < min_pixels; }), m_blobs.end());
+
+	std::sort(m_blobs.begin(), m_blobs.end(),
+		[](const Blob& a, const Blob& b) { return a.pixels > b.pixels; });
+
+	return m_blobs;
+}
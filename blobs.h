@@ -0,0 +1,73 @@
+#ifndef BLOBS_H__
+#define BLOBS_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include "workerpool.h"
+
+/**
+ * 8-connected region of foreground pixels
+ */
+struct Blob {
+	int min_x;
+	int min_y;
+	int max_x;
+	int max_y;
+	int pixels;
+
+	// Mean over pixels with valid depth, in depth units. 0 if none were valid.
+	float mean_depth;
+};
+
+/**
+ * Connected component labeling of a foreground mask.
+ *
+ * The mask is split into horizontal strips which are labeled in parallel:
+ * each strip is converted to runs of foreground pixels and overlapping runs
+ * on adjacent rows are joined with union-find. A serial merge pass then joins
+ * runs across strip borders and accumulates per-blob statistics.
+ */
+class BlobExtractor {
+public:
+	BlobExtractor(int w, int h, WorkerPool& pool);
+
+	/**
+	 * Label mask (non-zero = foreground) and collect blobs of at least
+	 * m_min_pixels pixels, largest first. depth may be NULL.
+	 */
+	const std::vector<Blob>& extract(const uint8_t* mask, const uint16_t* depth);
+
+	const std::vector<Blob>& blobs() const { return m_blobs; }
+
+	int m_min_pixels;
+
+private:
+	struct Run {
+		int16_t x0;
+		int16_t x1; // inclusive
+		int16_t y;
+		int pixels_valid;
+		uint64_t depth_sum;
+	};
+
+	struct Strip {
+		int y0;
+		int y1; // exclusive
+		std::vector<Run> runs;
+		std::vector<int> parent; // strip local run indices
+		std::vector<int> row_start; // first run index of each row, plus end marker
+	};
+
+	void label_strip(Strip& s, const uint8_t* mask, const uint16_t* depth);
+
+	int m_w;
+	int m_h;
+	WorkerPool& m_pool;
+	std::vector<Strip> m_strips;
+	std::vector<int> m_parent;
+	std::vector<int> m_blob_of_root;
+	std::vector<Blob> m_blobs;
+};
+
+#endif // BLOBS_H__
@@ -0,0 +1,155 @@
+#include "clocksync.h"
+
+#include <math.h>
+#include <algorithm>
+
+ClockSync::ClockSync(size_t window) {
+	m_hw.resize(window);
+	m_host.resize(window);
+	m_use.reserve(window);
+	m_lower.reserve(window);
+	m_residuals.reserve(window);
+	m_sorted.reserve(window);
+	m_head = 0;
+	m_count = 0;
+
+	// 32 bit microsecond counter, as in the frame timestamp metadata
+	m_wrap = 4294967.296;
+	m_last_hw = 0.0;
+	m_wrap_offset = 0.0;
+	m_have_last = false;
+
+	m_offset = 0.0;
+	m_rate = 1.0;
+	m_residual = 0.0;
+	m_valid = false;
+}
+
+double ClockSync::unwrap(double hw) {
+	if (m_have_last && m_wrap > 0.0 && hw + m_wrap_offset < m_last_hw - m_wrap / 2) {
+		m_wrap_offset += m_wrap;
+	}
+
+	m_have_last = true;
+	m_last_hw = hw + m_wrap_offset;
+	return m_last_hw;
+}
+
+void ClockSync::add_sample(double hw, double host) {
+	hw = unwrap(hw);
+
+	m_hw[m_head] = hw;
+	m_host[m_head] = host;
+	m_head = (m_head + 1) % m_hw.size();
+	if (m_count < m_hw.size()) {
+		m_count++;
+	}
+
+	fit();
+}
+
+/**
+ * Least squares of host on hw over the samples selected by use, relative to
+ * the first sample for precision. Returns false if the fit is degenerate.
+ */
+static bool fit_line(const std::vector<double>& hw, const std::vector<double>& host,
+	const std::vector<size_t>& use, double& offset, double& rate)
+{
+	if (use.size() < 2) {
+		return false;
+	}
+
+	double x0 = hw[use[0]];
+	double y0 = host[use[0]];
+	double sx = 0.0, sy = 0.0, sxx = 0.0, sxy = 0.0;
+	double n = (double)use.size();
+
+	for (size_t i = 0; i < use.size(); i++) {
+		double x = hw[use[i]] - x0;
+		double y = host[use[i]] - y0;
+		sx += x;
+		sy += y;
+		sxx += x * x;
+		sxy += x * y;
+	}
+
+	double den = n * sxx - sx * sx;
+	if (fabs(den) < 1.0e-9) {
+		return false;
+	}
+
+	rate = (n * sxy - sx * sy) / den;
+	double intercept = (sy - rate * sx) / n;
+	offset = y0 + intercept - rate * x0;
+	return true;
+}
+
+void ClockSync::fit() {
+	std::vector<size_t>& use = m_use;
+	use.clear();
+	for (size_t i = 0; i < m_count; i++) {
+		use.push_back((m_head + m_hw.size() - m_count + i) % m_hw.size());
+	}
+
+	double offset, rate;
+	if (!fit_line(m_hw, m_host, use, offset, rate)) {
+		// a single sample only gives an offset
+		if (m_count == 1 && !m_valid) {
+			m_offset = m_host[use[0]] - m_hw[use[0]];
+			m_rate = 1.0;
+		}
+		return;
+	}
+
+	// Refit twice to the lower half of the residuals
+	std::vector<double>& residuals = m_residuals;
+	std::vector<double>& sorted = m_sorted;
+	std::vector<size_t>& lower = m_lower;
+
+	for (int iter = 0; iter < 2 && use.size() >= 8; iter++) {
+		residuals.clear();
+		for (size_t i = 0; i < use.size(); i++) {
+			residuals.push_back(m_host[use[i]] - (offset + rate * m_hw[use[i]]));
+		}
+
+		sorted.assign(residuals.begin(), residuals.end());
+		std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+		double median = sorted[sorted.size() / 2];
+
+		lower.clear();
+		for (size_t i = 0; i < use.size(); i++) {
+			if (residuals[i] <= median) {
+				lower.push_back(use[i]);
+			}
+		}
+
+		double o, r;
+		if (!fit_line(m_hw, m_host, lower, o, r)) {
+			break;
+		}
+
+		use.swap(lower);
+		offset = o;
+		rate = r;
+	}
+
+	double sum = 0.0;
+	for (size_t i = 0; i < use.size(); i++) {
+		sum += fabs(m_host[use[i]] - (offset + rate * m_hw[use[i]]));
+	}
+
+	m_offset = offset;
+	m_rate = rate;
+	m_residual = sum / use.size();
+	m_valid = true;
+}
+
+double ClockSync::to_host(double hw) const {
+	// unwrap relative to the latest sample without touching the state
+	double unwrapped = hw + m_wrap_offset;
+	if (m_wrap > 0.0 && unwrapped < m_last_hw - m_wrap / 2) {
+		unwrapped += m_wrap;
+	}
+
+	return m_offset + m_rate * unwrapped;
+}
@@ -0,0 +1,74 @@
+#ifndef CLOCKSYNC_H__
+#define CLOCKSYNC_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Maps device hardware timestamps onto the host clock.
+ *
+ * Keeps a sliding window of (hardware time, host arrival time) pairs and fits
+ * host = offset + rate * hardware to it. Arrival times only ever lag the true
+ * capture time, by transfer and scheduling delays, so after an initial least
+ * squares fit the model is refit to the samples at or below the median
+ * residual. This follows the lower envelope of the arrival times and ignores
+ * delayed frames.
+ *
+ * All times are in milliseconds.
+ */
+class ClockSync {
+public:
+	ClockSync(size_t window);
+
+	/**
+	 * Add a sample and refit. hw is unwrapped first if the device counter
+	 * wrapped around.
+	 */
+	void add_sample(double hw, double host);
+
+	/**
+	 * Hardware timestamp to host time. Before the first fit, returns hw unchanged.
+	 */
+	double to_host(double hw) const;
+
+	bool valid() const { return m_valid; }
+
+	/** Hardware clock rate error relative to host in parts per million, positive if it runs fast */
+	double drift_ppm() const { return (1.0 / m_rate - 1.0) * 1.0e6; }
+
+	/** Host time of hardware time 0 of the unwrapped counter */
+	double offset() const { return m_offset; }
+
+	/** Mean absolute residual of the samples used in the last fit */
+	double residual() const { return m_residual; }
+
+	// Counter period of the hardware clock, 0 if it never wraps
+	double m_wrap;
+
+private:
+	double unwrap(double hw);
+	void fit();
+
+	std::vector<double> m_hw;
+	std::vector<double> m_host;
+	size_t m_head;
+	size_t m_count;
+
+	// fit() scratch, kept to not allocate per frame
+	std::vector<size_t> m_use;
+	std::vector<size_t> m_lower;
+	std::vector<double> m_residuals;
+	std::vector<double> m_sorted;
+
+	double m_last_hw;
+	double m_wrap_offset;
+	bool m_have_last;
+
+	double m_offset;
+	double m_rate;
+	double m_residual;
+	bool m_valid;
+};
+
+#endif // CLOCKSYNC_H__
@@ -0,0 +1,249 @@
+#include "colorframe.h"
+
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+static int64_t now_us() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static inline unsigned char clamp255(int v) {
+	return v < 0 ? 0 : (v > 255 ? 255 : (unsigned char)v);
+}
+
+/**
+ * BT.601 limited range YUYV (Y0 U Y1 V) to RGB8, 8 bit fixed point
+ */
+static void yuyv_to_rgb(const unsigned char* src, unsigned char* dst, int pixels) {
+	for (int i = 0; i < pixels; i += 2) {
+		int y0 = 298 * (src[0] - 16);
+		int u = src[1] - 128;
+		int y1 = 298 * (src[2] - 16);
+		int v = src[3] - 128;
+
+		int r = 409 * v + 128;
+		int g = -100 * u - 208 * v + 128;
+		int b = 516 * u + 128;
+
+		dst[0] = clamp255((y0 + r) >> 8);
+		dst[1] = clamp255((y0 + g) >> 8);
+		dst[2] = clamp255((y0 + b) >> 8);
+		dst[3] = clamp255((y1 + r) >> 8);
+		dst[4] = clamp255((y1 + g) >> 8);
+		dst[5] = clamp255((y1 + b) >> 8);
+
+		src += 4;
+		dst += 6;
+	}
+}
+
+/**
+ * FNV-1a over 32 bit words, bytewise for the tail
+ */
+static uint32_t payload_hash(const unsigned char* p, size_t size) {
+	uint32_t h = 2166136261u;
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4) {
+		uint32_t w;
+		memcpy(&w, p + i, 4);
+		h = (h ^ w) * 16777619u;
+	}
+	for (; i < size; i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+ColorFrame::ColorFrame(int w, int h, unsigned char* rgb_out) {
+	m_w = w;
+	m_h = h;
+	m_rgb = rgb_out;
+	m_raw.resize(w * h * 3);
+	m_size = 0;
+	m_format = RS2_FORMAT_ANY;
+	m_decoded = false;
+	m_tj = NULL;
+	m_raw_hash = 0;
+	m_raw_hash_valid = false;
+
+	m_stat_frames = 0;
+	m_stat_bytes = 0;
+	m_stat_wire_bytes = 0;
+	m_stat_decodes = 0;
+	m_stat_store_ms = 0.0;
+	m_stat_decode_ms = 0.0;
+	m_stat_start = now_us();
+}
+
+ColorFrame::~ColorFrame() {
+#ifdef HAVE_TURBOJPEG
+	if (m_tj) {
+		tjDestroy((tjhandle)m_tj);
+	}
+#endif
+}
+
+bool ColorFrame::supported(rs2_format format) {
+	switch (format) {
+	case RS2_FORMAT_RGB8:
+	case RS2_FORMAT_YUYV:
+		return true;
+#ifdef HAVE_TURBOJPEG
+	case RS2_FORMAT_MJPEG:
+		return true;
+#endif
+	default:
+		return false;
+	}
+}
+
+bool ColorFrame::store(const void* data, size_t size, rs2_format format, TileChangeMap* tiles) {
+	if (!supported(format) || size > m_raw.size()) {
+		return false;
+	}
+
+	if ((format == RS2_FORMAT_RGB8 && size != (size_t)m_w * m_h * 3) ||
+		(format == RS2_FORMAT_YUYV && size != (size_t)m_w * m_h * 2)) {
+		return false;
+	}
+
+	int64_t t1 = now_us();
+
+	m_format = format;
+	m_size = size;
+
+	if (format == RS2_FORMAT_RGB8) {
+		// already what consumers want, skip the intermediate copy
+		if (tiles) {
+			copy_color_tracked(m_rgb, (const unsigned char*)data, *tiles);
+		} else {
+			memcpy(m_rgb, data, size);
+		}
+		m_decoded = true;
+	} else {
+		memcpy(m_raw.data(), data, size);
+
+		uint32_t hash = payload_hash(m_raw.data(), size);
+		bool changed = !m_raw_hash_valid || hash != m_raw_hash;
+		m_raw_hash = hash;
+		m_raw_hash_valid = true;
+
+		// an identical frame is still decoded in m_rgb
+		if (changed) {
+			m_decoded = false;
+		}
+
+		if (tiles) {
+			if (changed) {
+				tiles->mark_all();
+			} else {
+				tiles->clear();
+			}
+		}
+	}
+
+	m_stat_frames++;
+	m_stat_bytes += size;
+	m_stat_wire_bytes += format == RS2_FORMAT_RGB8 ? (uint64_t)m_w * m_h * 2 : size;
+	m_stat_store_ms += (now_us() - t1) / 1000.0;
+	return true;
+}
+
+const unsigned char* ColorFrame::rgb() {
+	if (m_decoded) {
+		return m_rgb;
+	}
+
+	if (m_size == 0) {
+		return NULL;
+	}
+
+	int64_t t1 = now_us();
+
+	if (m_format == RS2_FORMAT_YUYV) {
+		yuyv_to_rgb(m_raw.data(), m_rgb, m_w * m_h);
+	} else if (m_format == RS2_FORMAT_MJPEG) {
+		if (!decode_mjpeg()) {
+			return NULL;
+		}
+	} else {
+		return NULL;
+	}
+
+	m_decoded = true;
+	m_stat_decodes++;
+	m_stat_decode_ms += (now_us() - t1) / 1000.0;
+	return m_rgb;
+}
+
+bool ColorFrame::decode_mjpeg() {
+#ifdef HAVE_TURBOJPEG
+	if (m_tj == NULL) {
+		m_tj = tjInitDecompress();
+		if (m_tj == NULL) {
+			std::cout << "tjInitDecompress failed: " << tjGetErrorStr() << std::endl;
+			return false;
+		}
+	}
+
+	tjhandle tj = (tjhandle)m_tj;
+	int w, h, subsamp, colorspace;
+
+	if (tjDecompressHeader3(tj, m_raw.data(), m_size, &w, &h, &subsamp, &colorspace) != 0) {
+		std::cout << "Invalid MJPEG frame: " << tjGetErrorStr2(tj) << std::endl;
+		return false;
+	}
+
+	if (w != m_w || h != m_h) {
+		std::cout << "Invalid MJPEG frame resolution: " << w << ", " << h << std::endl;
+		return false;
+	}
+
+	if (tjDecompress2(tj, m_raw.data(), m_size, m_rgb, m_w, 0, m_h, TJPF_RGB, TJFLAG_FASTDCT | TJFLAG_FASTUPSAMPLE) != 0) {
+		std::cout << "Failed decoding MJPEG frame: " << tjGetErrorStr2(tj) << std::endl;
+		return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+void ColorFrame::print_stats() {
+	int64_t now = now_us();
+	double secs = (now - m_stat_start) / 1000000.0;
+
+	if (m_stat_frames == 0 || secs <= 0.0) {
+		return;
+	}
+
+	std::cout << "color " << rs2_format_to_string(m_format) << ": "
+		<< m_stat_bytes / secs / (1024.0 * 1024.0) << " MiB/s delivered, "
+		<< m_stat_wire_bytes / secs / (1024.0 * 1024.0) << " MiB/s over USB, "
+		<< m_stat_bytes / m_stat_frames / 1024 << " KiB per delivered frame, store "
+		<< m_stat_store_ms / m_stat_frames << " ms per frame";
+
+	if (m_stat_decodes) {
+		std::cout << ", decoded " << m_stat_decodes << "/" << m_stat_frames << " frames in "
+			<< m_stat_decode_ms / m_stat_decodes << " ms each";
+	}
+
+	std::cout << std::endl;
+
+	m_stat_frames = 0;
+	m_stat_bytes = 0;
+	m_stat_wire_bytes = 0;
+	m_stat_decodes = 0;
+	m_stat_store_ms = 0.0;
+	m_stat_decode_ms = 0.0;
+	m_stat_start = now;
+}
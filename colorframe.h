@@ -0,0 +1,86 @@
+#ifndef COLORFRAME_H__
+#define COLORFRAME_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+#include "framechange.h"
+
+/**
+ * Latest color frame, kept in the format the sensor delivered it in.
+ *
+ * RGB8 frames are stored as is. YUYV and MJPEG frames are kept compressed and
+ * only converted to RGB8 when a consumer calls rgb(). Conversion happens at
+ * most once per frame.
+ */
+class ColorFrame {
+public:
+	/**
+	 * rgb_out receives decoded w * h RGB8 images
+	 */
+	ColorFrame(int w, int h, unsigned char* rgb_out);
+	virtual ~ColorFrame();
+
+	/**
+	 * True if frames of this format can be stored and decoded
+	 */
+	static bool supported(rs2_format format);
+
+	/**
+	 * Copy a frame's raw data. Returns false if the format is unsupported or
+	 * the frame does not fit.
+	 *
+	 * RGB8 frames update tiles with their changes. Compressed frames are not
+	 * decoded here: they mark every tile as changed if their payload differs
+	 * from the previous frame's, and none otherwise.
+	 */
+	bool store(const void* data, size_t size, rs2_format format, TileChangeMap* tiles = NULL);
+
+	/**
+	 * The frame as RGB8, decoding it if needed. NULL if decoding failed.
+	 */
+	const unsigned char* rgb();
+
+	/** True once rgb() holds the current frame */
+	bool decoded() const { return m_decoded; }
+
+	rs2_format format() const { return m_format; }
+	const unsigned char* data() const { return m_raw.data(); }
+	size_t size() const { return m_size; }
+
+	/**
+	 * Print the data rate of frames as delivered by the SDK and as sent over
+	 * USB, and conversion cost since the previous call. RGB8 is converted by
+	 * the SDK from YUYV, which is what the sensor sends.
+	 */
+	void print_stats();
+
+private:
+	bool decode_mjpeg();
+
+	int m_w;
+	int m_h;
+	unsigned char* m_rgb;
+	std::vector<unsigned char> m_raw;
+	size_t m_size;
+	rs2_format m_format;
+	bool m_decoded;
+	void* m_tj;
+
+	// payload hash of the previous compressed frame, for change tracking
+	uint32_t m_raw_hash;
+	bool m_raw_hash_valid;
+
+	uint64_t m_stat_frames;
+	uint64_t m_stat_bytes;
+	uint64_t m_stat_wire_bytes;
+	uint64_t m_stat_decodes;
+	double m_stat_store_ms;
+	double m_stat_decode_ms;
+	int64_t m_stat_start;
+};
+
+#endif // COLORFRAME_H__
@@ -0,0 +1,160 @@
+#include "colorizer.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define COLORIZER_USE_SSE2 1
+#endif
+
+static float clamp01(float v) {
+	return v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+}
+
+static uint32_t pack_rgb(float r, float g, float b) {
+	uint32_t ir = (uint32_t)(clamp01(r) * 255.0f + 0.5f);
+	uint32_t ig = (uint32_t)(clamp01(g) * 255.0f + 0.5f);
+	uint32_t ib = (uint32_t)(clamp01(b) * 255.0f + 0.5f);
+	return ir | (ig << 8) | (ib << 16);
+}
+
+static uint32_t jet(float t) {
+	return pack_rgb(1.5f - fabsf(4.0f * t - 3.0f),
+		1.5f - fabsf(4.0f * t - 2.0f),
+		1.5f - fabsf(4.0f * t - 1.0f));
+}
+
+/**
+ * Polynomial approximation of Google's Turbo colormap
+ */
+static uint32_t turbo(float t) {
+	float r = 0.13572138f + t * (4.61539260f + t * (-42.66032258f + t * (132.13108234f + t * (-152.94239396f + t * 59.28637943f))));
+	float g = 0.09140261f + t * (2.19418839f + t * (4.84296658f + t * (-14.18503333f + t * (4.27729857f + t * 2.82956604f))));
+	float b = 0.10667330f + t * (12.64194608f + t * (-60.58204836f + t * (110.36276771f + t * (-89.90310912f + t * 27.34824973f))));
+	return pack_rgb(r, g, b);
+}
+
+DepthColorizer::DepthColorizer(Palette palette) {
+	m_equalize = false;
+	m_histogram.resize(0x10000);
+	m_lut.resize(0x10000);
+	set_range(300, 6000);
+	set_palette(palette);
+}
+
+void DepthColorizer::set_palette(Palette palette) {
+	m_palette[0] = 0;
+
+	for (int i = 1; i < 256; i++) {
+		float t = (i - 1) / 254.0f;
+		m_palette[i] = palette == PALETTE_TURBO ? turbo(t) : jet(t);
+	}
+}
+
+void DepthColorizer::set_range(uint16_t min_depth, uint16_t max_depth) {
+	// keep the fixed point scale factor below 1 << 16
+	if (max_depth < min_depth + 255) {
+		max_depth = std::min(65535, min_depth + 255);
+		min_depth = max_depth - 255;
+	}
+
+	m_min = min_depth;
+	m_max = max_depth;
+}
+
+/**
+ * idx = 1 + (clamp(d, min, max) - min) * 254 / (max - min), 0 without depth
+ */
+void DepthColorizer::index_range(const uint16_t* depth, int n, uint8_t* idx) const {
+	const uint32_t range = m_max - m_min;
+	const uint32_t scale = (254u << 16) / range;
+	int i = 0;
+
+#ifdef COLORIZER_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i vmin = _mm_set1_epi16((short)m_min);
+	const __m128i vrange = _mm_set1_epi16((short)range);
+	const __m128i vscale = _mm_set1_epi16((short)scale);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i out[2];
+
+		for (int k = 0; k < 2; k++) {
+			__m128i d = _mm_loadu_si128((const __m128i*)(depth + i + k * 8));
+			__m128i invalid = _mm_cmpeq_epi16(d, zero);
+
+			// min(d - min, range) with saturation, no unsigned min in SSE2
+			__m128i v = _mm_subs_epu16(d, vmin);
+			v = _mm_sub_epi16(v, _mm_subs_epu16(v, vrange));
+			v = _mm_add_epi16(_mm_mulhi_epu16(v, vscale), one);
+			out[k] = _mm_andnot_si128(invalid, v);
+		}
+
+		_mm_storeu_si128((__m128i*)(idx + i), _mm_packus_epi16(out[0], out[1]));
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint16_t d = depth[i];
+		if (d == 0) {
+			idx[i] = 0;
+			continue;
+		}
+
+		uint32_t v = d > m_min ? d - m_min : 0;
+		if (v > range) {
+			v = range;
+		}
+		idx[i] = (uint8_t)(((v * scale) >> 16) + 1);
+	}
+}
+
+void DepthColorizer::index_equalized(const uint16_t* depth, int n, uint8_t* idx) {
+	uint32_t* hist = m_histogram.data();
+	memset(hist, 0, m_histogram.size() * sizeof(uint32_t));
+
+	for (int i = 0; i < n; i++) {
+		hist[depth[i]]++;
+	}
+
+	uint32_t valid = n - hist[0];
+	uint32_t cumulative = 0;
+	m_lut[0] = 0;
+
+	for (int d = 1; d < 0x10000; d++) {
+		cumulative += hist[d];
+		m_lut[d] = valid ? (uint8_t)(1 + (uint64_t)cumulative * 254 / valid) : 0;
+	}
+
+	for (int i = 0; i < n; i++) {
+		idx[i] = m_lut[depth[i]];
+	}
+}
+
+void DepthColorizer::colorize(const uint16_t* depth, int n, unsigned char* rgb) {
+	if (n <= 0) {
+		return;
+	}
+
+	m_idx.resize(n);
+	uint8_t* idx = m_idx.data();
+
+	if (m_equalize) {
+		index_equalized(depth, n, idx);
+	} else {
+		index_range(depth, n, idx);
+	}
+
+	// Write 4 bytes per 3 byte pixel, the next pixel overwrites the extra byte
+	for (int i = 0; i < n - 1; i++) {
+		memcpy(rgb + i * 3, &m_palette[idx[i]], 4);
+	}
+
+	uint32_t last = m_palette[idx[n - 1]];
+	rgb[(n - 1) * 3 + 0] = last & 0xff;
+	rgb[(n - 1) * 3 + 1] = (last >> 8) & 0xff;
+	rgb[(n - 1) * 3 + 2] = (last >> 16) & 0xff;
+}
@@ -0,0 +1,55 @@
+#ifndef COLORIZER_H__
+#define COLORIZER_H__
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Converts Z16 depth into RGB8 for previews, as a cheap replacement for
+ * rs2::colorizer.
+ *
+ * Depth is first reduced to a palette index (SIMD scaling of a fixed range,
+ * or a histogram equalization lookup table), which then selects one of 255
+ * palette colors. Pixels without depth are black.
+ */
+class DepthColorizer {
+public:
+	enum Palette {
+		PALETTE_JET,
+		PALETTE_TURBO
+	};
+
+	DepthColorizer(Palette palette);
+
+	void set_palette(Palette palette);
+
+	/**
+	 * Depth range mapped onto the palette, in depth units. Depth outside of
+	 * the range is clamped. Not used when equalizing.
+	 */
+	void set_range(uint16_t min_depth, uint16_t max_depth);
+
+	/**
+	 * Writes n pixels of RGB8 into rgb
+	 */
+	void colorize(const uint16_t* depth, int n, unsigned char* rgb);
+
+	// Spread colors evenly over the depth values present in each frame
+	bool m_equalize;
+
+private:
+	void index_range(const uint16_t* depth, int n, uint8_t* idx) const;
+	void index_equalized(const uint16_t* depth, int n, uint8_t* idx);
+
+	uint16_t m_min;
+	uint16_t m_max;
+
+	// 0xBBGGRR (RGB byte order on little endian), entry 0 is for pixels without depth
+	uint32_t m_palette[256];
+
+	std::vector<uint32_t> m_histogram;
+	std::vector<uint8_t> m_lut;
+	std::vector<uint8_t> m_idx;
+};
+
+#endif // COLORIZER_H__
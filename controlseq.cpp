@@ -0,0 +1,192 @@
+#include "controlseq.h"
+
+#include <iostream>
+
+ControlSequence::ControlSequence(const std::string& name, MetadataMonitor* monitor)
+	: m_name(name), m_current(0), m_started(false), m_failed(false)
+{
+	m_ctx.attempts = 0;
+	m_ctx.checked = 0;
+	m_ctx.monitor = monitor;
+	m_ctx.marker = monitor ? monitor->observed() : 0;
+}
+
+ControlSequence& ControlSequence::set_option(const rs2::sensor& sensor, rs2_option option, float value,
+	int tries, int retry_ms)
+{
+	rs2::sensor s = sensor;
+	std::string name = m_name;
+
+	return then([s, option, value, tries, retry_ms, name](Context& ctx) -> Status {
+		// back off only between retries
+		if (ctx.now < ctx.wake) {
+			return STEP_WAIT;
+		}
+
+		ctx.attempts++;
+
+		try {
+			if (ctx.monitor) {
+				ctx.marker = ctx.monitor->mark();
+			}
+			ctx.sent = std::chrono::steady_clock::now();
+			s.set_option(option, value);
+			std::cout << name << ": set " << rs2_option_to_string(option) << " to " << value << std::endl;
+			return STEP_DONE;
+		} catch (const rs2::error& e) {
+			std::cout << "RealSense error calling " << e.get_failed_function()
+				<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+				" when setting " << rs2_option_to_string(option) << "." << std::endl;
+		}
+
+		if (ctx.attempts >= tries) {
+			return STEP_FAILED;
+		}
+
+		ctx.wake = ctx.now + std::chrono::milliseconds(retry_ms);
+		return STEP_WAIT;
+	});
+}
+
+ControlSequence& ControlSequence::set_roi(const rs2::roi_sensor& sensor, const rs2::region_of_interest& roi,
+	int tries, int retry_ms)
+{
+	rs2::roi_sensor s = sensor;
+	std::string name = m_name;
+
+	return then([s, roi, tries, retry_ms, name](Context& ctx) mutable -> Status {
+		if (ctx.now < ctx.wake) {
+			return STEP_WAIT;
+		}
+
+		ctx.attempts++;
+
+		try {
+			if (ctx.monitor) {
+				ctx.marker = ctx.monitor->mark();
+			}
+			ctx.sent = std::chrono::steady_clock::now();
+			s.set_region_of_interest(roi);
+			std::cout << name << ": set region of interest " << roi.min_x << "," << roi.min_y
+				<< " - " << roi.max_x << "," << roi.max_y << std::endl;
+			return STEP_DONE;
+		} catch (const rs2::error& e) {
+			std::cout << "RealSense error calling " << e.get_failed_function()
+				<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+				" when setting auto exposure region of interest." << std::endl;
+		}
+
+		if (ctx.attempts >= tries) {
+			return STEP_FAILED;
+		}
+
+		ctx.wake = ctx.now + std::chrono::milliseconds(retry_ms);
+		return STEP_WAIT;
+	});
+}
+
+ControlSequence& ControlSequence::await(const char* what, const MetadataMonitor::Predicate& pred, int timeout_ms) {
+	std::string name = m_name;
+	std::string label = what;
+
+	return then([pred, timeout_ms, name, label](Context& ctx) -> Status {
+		if (!ctx.monitor) {
+			return STEP_DONE;
+		}
+
+		FrameMetadata m;
+		if (ctx.monitor->poll(ctx.checked, pred, &m)) {
+			std::cout << name << ": " << label << " confirmed by frame " << m.frame_number << ", "
+				<< std::chrono::duration<double, std::milli>(m.arrival - ctx.sent).count()
+				<< " ms after the command" << std::endl;
+			return STEP_DONE;
+		}
+
+		ctx.wake = ctx.started + std::chrono::milliseconds(timeout_ms);
+		if (ctx.now >= ctx.wake) {
+			std::cout << name << ": " << label << " not confirmed by frame metadata within "
+				<< timeout_ms << " ms" << std::endl;
+			return STEP_DONE;
+		}
+
+		return STEP_WAIT;
+	});
+}
+
+ControlSequence& ControlSequence::sleep(int ms) {
+	return then([ms](Context& ctx) -> Status {
+		ctx.wake = ctx.started + std::chrono::milliseconds(ms);
+		return ctx.now >= ctx.wake ? STEP_DONE : STEP_WAIT;
+	});
+}
+
+ControlSequence& ControlSequence::then(const Step& step) {
+	m_steps.push_back(step);
+	return *this;
+}
+
+void ControlSequence::start_step(std::chrono::steady_clock::time_point now) {
+	m_ctx.started = now;
+	m_ctx.wake = now;
+	m_ctx.attempts = 0;
+	m_ctx.checked = m_ctx.marker;
+	m_ctx.skip = 0;
+}
+
+bool ControlSequence::advance(std::chrono::steady_clock::time_point now) {
+	if (!m_started) {
+		start_step(now);
+		m_started = true;
+	}
+
+	m_ctx.now = now;
+
+	while (m_current < m_steps.size()) {
+		Status s = m_steps[m_current](m_ctx);
+
+		if (s == STEP_WAIT) {
+			return true;
+		}
+
+		if (s == STEP_FAILED) {
+			std::cout << m_name << ": step " << m_current + 1 << " of " << m_steps.size()
+				<< " failed, abandoning the sequence" << std::endl;
+			m_failed = true;
+			return false;
+		}
+
+		m_current += 1 + m_ctx.skip;
+		start_step(now);
+	}
+
+	return false;
+}
+
+void ControlScheduler::add(const ControlSequence& seq) {
+	m_sequences.push_back(seq);
+}
+
+int ControlScheduler::poll() {
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	int next = -1;
+
+	std::list<ControlSequence>::iterator it = m_sequences.begin();
+	while (it != m_sequences.end()) {
+		if (!it->advance(now)) {
+			it = m_sequences.erase(it);
+			continue;
+		}
+
+		int ms = (int)std::chrono::duration_cast<std::chrono::milliseconds>(it->wake() - now).count();
+		if (ms < 0) {
+			ms = 0;
+		}
+		if (next < 0 || ms < next) {
+			next = ms;
+		}
+
+		++it;
+	}
+
+	return next;
+}
@@ -0,0 +1,124 @@
+#ifndef CONTROLSEQ_H__
+#define CONTROLSEQ_H__
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <string>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+#include "framemeta.h"
+
+/**
+ * A list of camera control steps run one after another without blocking:
+ * option writes, waits for a frame metadata condition and timers. A step that
+ * cannot finish yet returns STEP_WAIT and is resumed by the next poll of its
+ * ControlScheduler, so many sequences across cameras share the thread that
+ * polls them.
+ *
+ * Commands take a marker on the sequence's MetadataMonitor right before they
+ * are sent; await() waits for a frame after the last command.
+ */
+class ControlSequence {
+public:
+	enum Status {
+		STEP_DONE,
+		STEP_WAIT,
+		STEP_FAILED
+	};
+
+	/**
+	 * State of the running step. The per-step fields are reset when a step
+	 * starts; marker and sent carry over from the last command.
+	 */
+	struct Context {
+		std::chrono::steady_clock::time_point now;
+		std::chrono::steady_clock::time_point started;
+		int attempts;
+		uint64_t checked;
+
+		// steps to jump over once this one is done
+		int skip;
+
+		// set by a step returning STEP_WAIT to be resumed no later than this
+		std::chrono::steady_clock::time_point wake;
+
+		MetadataMonitor* monitor;
+		uint64_t marker;
+		std::chrono::steady_clock::time_point sent;
+	};
+
+	typedef std::function<Status(Context&)> Step;
+
+	/**
+	 * monitor may be NULL if the sequence never awaits frames
+	 */
+	ControlSequence(const std::string& name, MetadataMonitor* monitor);
+
+	/**
+	 * Write an option, retrying every retry_ms up to tries times on rs2::error
+	 */
+	ControlSequence& set_option(const rs2::sensor& sensor, rs2_option option, float value,
+		int tries = 10, int retry_ms = 33);
+
+	ControlSequence& set_roi(const rs2::roi_sensor& sensor, const rs2::region_of_interest& roi,
+		int tries = 10, int retry_ms = 33);
+
+	/**
+	 * Wait for a frame after the last command matching pred. Not matching
+	 * within timeout_ms is reported and the sequence carries on.
+	 */
+	ControlSequence& await(const char* what, const MetadataMonitor::Predicate& pred, int timeout_ms);
+
+	ControlSequence& sleep(int ms);
+
+	/**
+	 * Any other step
+	 */
+	ControlSequence& then(const Step& step);
+
+	/**
+	 * Run steps until one has to wait. Returns false once the sequence has
+	 * finished or failed.
+	 */
+	bool advance(std::chrono::steady_clock::time_point now);
+
+	std::chrono::steady_clock::time_point wake() const { return m_ctx.wake; }
+	const std::string& name() const { return m_name; }
+	bool failed() const { return m_failed; }
+
+private:
+	void start_step(std::chrono::steady_clock::time_point now);
+
+	std::string m_name;
+	std::vector<Step> m_steps;
+	size_t m_current;
+	bool m_started;
+	bool m_failed;
+	Context m_ctx;
+};
+
+/**
+ * Runs control sequences on the thread calling poll(). Not thread safe.
+ */
+class ControlScheduler {
+public:
+	void add(const ControlSequence& seq);
+
+	/**
+	 * Advance every sequence as far as it goes without blocking and drop the
+	 * finished ones. Returns ms until a waiting sequence wants to be polled
+	 * again, -1 if none are left.
+	 */
+	int poll();
+
+	size_t active() const { return m_sequences.size(); }
+
+private:
+	std::list<ControlSequence> m_sequences;
+};
+
+#endif // CONTROLSEQ_H__
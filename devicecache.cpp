@@ -0,0 +1,119 @@
+#include "devicecache.h"
+
+#include <stdio.h>
+#include <inttypes.h>
+#include <iostream>
+
+DeviceStateCache::DeviceStateCache(const std::string& path) {
+	m_path = path;
+	m_dirty = false;
+}
+
+static std::string cache_key(const std::string& serial, const std::string& firmware) {
+	return serial + " " + firmware;
+}
+
+bool DeviceStateCache::load() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_entries.clear();
+	m_dirty = false;
+
+	FILE* f = fopen(m_path.c_str(), "r");
+	if (f == NULL) {
+		return true;
+	}
+
+	bool ok = true;
+	char serial[128];
+	char firmware[128];
+	uint64_t hash;
+	int n;
+
+	while ((n = fscanf(f, "%127s %127s %" SCNx64, serial, firmware, &hash)) == 3) {
+		m_entries[cache_key(serial, firmware)] = hash;
+	}
+
+	if (n != EOF) {
+		std::cout << "Ignoring malformed device state cache " << m_path << std::endl;
+		m_entries.clear();
+		m_dirty = true;
+		ok = false;
+	}
+
+	fclose(f);
+	return ok;
+}
+
+bool DeviceStateCache::save() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!m_dirty) {
+		return true;
+	}
+
+	// Write a new file and rename it over the old one, so a crash leaves either
+	// the old or the new cache
+	std::string tmp = m_path + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "w");
+	if (f == NULL) {
+		std::cout << "Failed writing device state cache " << tmp << std::endl;
+		return false;
+	}
+
+	for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+		fprintf(f, "%s %016" PRIx64 "\n", it->first.c_str(), it->second);
+	}
+
+	bool ok = fclose(f) == 0;
+	if (ok) {
+#ifdef WIN32
+		// rename() does not replace an existing file on Windows
+		remove(m_path.c_str());
+#endif
+		ok = rename(tmp.c_str(), m_path.c_str()) == 0;
+	}
+
+	if (!ok) {
+		std::cout << "Failed writing device state cache " << m_path << std::endl;
+		return false;
+	}
+
+	m_dirty = false;
+	return true;
+}
+
+bool DeviceStateCache::lookup(const std::string& serial, const std::string& firmware, uint64_t& hash) const {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_entries.find(cache_key(serial, firmware));
+	if (it == m_entries.end()) {
+		return false;
+	}
+
+	hash = it->second;
+	return true;
+}
+
+void DeviceStateCache::store(const std::string& serial, const std::string& firmware, uint64_t hash) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::string key = cache_key(serial, firmware);
+	auto it = m_entries.find(key);
+	if (it == m_entries.end() || it->second != hash) {
+		m_entries[key] = hash;
+		m_dirty = true;
+	}
+}
+
+void DeviceStateCache::forget(const std::string& serial, const std::string& firmware) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_entries.erase(cache_key(serial, firmware))) {
+		m_dirty = true;
+	}
+}
+
+uint64_t DeviceStateCache::hash(const char* preset) {
+	uint64_t h = 14695981039346656037ULL;
+	for (const unsigned char* p = (const unsigned char*)preset; *p; p++) {
+		h ^= *p;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
@@ -0,0 +1,54 @@
+#ifndef DEVICECACHE_H__
+#define DEVICECACHE_H__
+
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+/**
+ * Settings preset last applied to each camera, kept in a small text file
+ * between runs. Cameras are keyed by serial number and firmware version,
+ * as a firmware update resets the advanced mode settings.
+ *
+ * File format, one camera per line: <serial> <firmware> <preset hash in hex>
+ *
+ * Thread safe, cameras may be prepared in parallel.
+ */
+class DeviceStateCache {
+public:
+	DeviceStateCache(const std::string& path);
+
+	/**
+	 * Read the file. A missing file is an empty cache. Returns false on parse errors.
+	 */
+	bool load();
+
+	/**
+	 * Write the file if anything changed since load()
+	 */
+	bool save();
+
+	/**
+	 * Hash of the preset last applied to the camera. False if not known.
+	 */
+	bool lookup(const std::string& serial, const std::string& firmware, uint64_t& hash) const;
+
+	void store(const std::string& serial, const std::string& firmware, uint64_t hash);
+
+	/**
+	 * Forget a camera, e.g. after its settings were found not to match the cache
+	 */
+	void forget(const std::string& serial, const std::string& firmware);
+
+	/** 64 bit FNV-1a of a preset */
+	static uint64_t hash(const char* preset);
+
+private:
+	std::string m_path;
+	std::map<std::string, uint64_t> m_entries;
+	bool m_dirty;
+	mutable std::mutex m_mutex;
+};
+
+#endif // DEVICECACHE_H__
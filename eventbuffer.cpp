@@ -0,0 +1,490 @@
+#include "eventbuffer.h"
+
+#include <signal.h>
+#include <string.h>
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#ifndef WIN32
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+#include "recorder.h"
+
+static volatile sig_atomic_t g_signal_trigger = 0;
+
+#ifndef WIN32
+static void trigger_signal_handler(int) {
+	g_signal_trigger = 1;
+}
+#endif
+
+/**
+ * Z16 to bytes: difference to the previous pixel, zigzag coded into 1 to 3
+ * byte varints. Smooth surfaces and invalid (zero) areas take one byte per
+ * pixel. Returns the compressed size, at most n * 3 bytes.
+ */
+static size_t compress_depth(const uint16_t* depth, size_t n, unsigned char* out) {
+	unsigned char* p = out;
+	int prev = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		int d = depth[i] - prev;
+		prev = depth[i];
+
+		uint32_t z = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+		while (z >= 0x80) {
+			*p++ = (unsigned char)(z | 0x80);
+			z >>= 7;
+		}
+		*p++ = (unsigned char)z;
+	}
+
+	return p - out;
+}
+
+bool EventBuffer::decompress_depth(const unsigned char* data, size_t size, uint16_t* depth, size_t n) {
+	const unsigned char* p = data;
+	const unsigned char* end = data + size;
+	int prev = 0;
+
+	for (size_t i = 0; i < n; i++) {
+		uint32_t z = 0;
+		int shift = 0;
+
+		while (true) {
+			if (p == end || shift > 14) {
+				return false;
+			}
+
+			unsigned char b = *p++;
+			z |= (uint32_t)(b & 0x7f) << shift;
+			shift += 7;
+			if (!(b & 0x80)) {
+				break;
+			}
+		}
+
+		int d = (int)(z >> 1) ^ -(int)(z & 1);
+		prev += d;
+		depth[i] = (uint16_t)prev;
+	}
+
+	return p == end;
+}
+
+EventBuffer::EventBuffer(size_t max_depth_size, size_t max_color_size, size_t budget, int pre_frames,
+	int post_frames, bool compress)
+	: m_staging(4), m_ring(budget)
+{
+	m_pre = pre_frames;
+	m_post = post_frames;
+	m_compress = compress;
+	m_max_depth_size = max_depth_size;
+	m_max_color_size = max_color_size;
+	m_dir = ".";
+
+	for (size_t i = 0; i < m_staging.size(); i++) {
+		m_staging[i].depth.resize(max_depth_size / sizeof(uint16_t));
+		m_staging[i].color.resize(max_color_size);
+		m_stage_free.push_back((int)i);
+	}
+
+	m_stage_quit = false;
+	m_ring_head = 0;
+	m_pin_seq = UINT64_MAX;
+	m_pushed = 0;
+	m_packed = 0;
+	m_event_pending = false;
+	m_event_first = 0;
+	m_event_end = 0;
+	m_udp_fd = -1;
+	m_quit = false;
+
+	m_events = 0;
+	m_saved = 0;
+	m_lost = 0;
+	m_skipped = 0;
+
+	m_packer = std::thread(&EventBuffer::packer_main, this);
+	m_writer = std::thread(&EventBuffer::writer_main, this);
+}
+
+EventBuffer::~EventBuffer() {
+	stop();
+
+#ifndef WIN32
+	if (m_udp_fd >= 0) {
+		close(m_udp_fd);
+	}
+#endif
+}
+
+void EventBuffer::stop() {
+	// The packer goes first, so the writer sees every frameset there is
+	{
+		std::lock_guard<std::mutex> lock(m_stage_mutex);
+		m_stage_quit = true;
+	}
+	m_stage_cv.notify_all();
+	if (m_packer.joinable()) {
+		m_packer.join();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_cv.notify_all();
+	if (m_writer.joinable()) {
+		m_writer.join();
+	}
+
+	if (m_udp.joinable()) {
+		m_udp.join();
+	}
+}
+
+void EventBuffer::set_directory(const std::string& dir) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_dir = dir;
+}
+
+size_t EventBuffer::buffered() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_entries.size();
+}
+
+void EventBuffer::push(const uint16_t* depth, size_t depth_size, const unsigned char* color, size_t color_size,
+	uint64_t frame_number, double timestamp)
+{
+	if (color == NULL) {
+		color_size = 0;
+	}
+
+	if (depth_size > m_max_depth_size || color_size > m_max_color_size) {
+		m_skipped++;
+		return;
+	}
+
+	// Never wait for the packer, skip the frameset instead
+	int slot;
+	{
+		std::lock_guard<std::mutex> lock(m_stage_mutex);
+		if (m_stage_free.empty()) {
+			m_skipped++;
+			return;
+		}
+
+		slot = m_stage_free.back();
+		m_stage_free.pop_back();
+	}
+
+	// slot is owned by this thread until queued
+	Staging& st = m_staging[slot];
+	memcpy(st.depth.data(), depth, depth_size);
+	if (color_size) {
+		memcpy(st.color.data(), color, color_size);
+	}
+	st.depth_size = depth_size;
+	st.color_size = color_size;
+	st.frame_number = frame_number;
+	st.timestamp = timestamp;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		st.seq = m_pushed++;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_stage_mutex);
+		m_stage_filled.push_back(slot);
+	}
+
+	m_stage_cv.notify_one();
+}
+
+bool EventBuffer::ring_alloc(size_t size, size_t& pos) {
+	pos = m_ring_head;
+	bool wrap = pos + size > m_ring.size();
+	if (wrap) {
+		pos = 0;
+	}
+
+	// Entries are evicted oldest first: on a wrap every entry past the old
+	// head goes, then whatever overlaps the new space
+	size_t evict = 0;
+	while (evict < m_entries.size()) {
+		const Entry& e = m_entries[evict];
+		bool in_tail = wrap && e.offset >= m_ring_head;
+		bool overlaps = e.offset < pos + size && pos < e.offset + e.size;
+		if (!in_tail && !overlaps) {
+			break;
+		}
+		if (e.seq >= m_pin_seq) {
+			return false;
+		}
+		evict++;
+	}
+
+	m_entries.erase(m_entries.begin(), m_entries.begin() + evict);
+	m_ring_head = pos + size;
+	return true;
+}
+
+void EventBuffer::packer_main() {
+	// Compressed depth takes up to 3 bytes per pixel in the worst case
+	size_t depth_bytes = m_compress ? m_max_depth_size / 2 * 3 : m_max_depth_size;
+	std::vector<unsigned char> packed(sizeof(EventFrameHeader) + depth_bytes + m_max_color_size);
+
+	while (true) {
+		int slot;
+		{
+			std::unique_lock<std::mutex> lock(m_stage_mutex);
+			m_stage_cv.wait(lock, [&] { return m_stage_quit || !m_stage_filled.empty(); });
+			if (m_stage_filled.empty()) {
+				return;
+			}
+
+			slot = m_stage_filled.front();
+			m_stage_filled.pop_front();
+		}
+
+		Staging& st = m_staging[slot];
+
+		EventFrameHeader h;
+		memset(&h, 0, sizeof(h));
+		unsigned char* p = packed.data() + sizeof(h);
+
+		if (m_compress) {
+			h.depth_size = (uint32_t)compress_depth(st.depth.data(), st.depth_size / sizeof(uint16_t), p);
+			h.depth_compressed = 1;
+		} else {
+			h.depth_size = (uint32_t)st.depth_size;
+			memcpy(p, st.depth.data(), st.depth_size);
+		}
+
+		h.color_size = (uint32_t)st.color_size;
+		memcpy(p + h.depth_size, st.color.data(), st.color_size);
+		memcpy(packed.data(), &h, sizeof(h));
+
+		size_t size = sizeof(h) + h.depth_size + h.color_size;
+
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+
+			// Framesets larger than the whole ring are dropped, the writer
+			// counts them as lost
+			if (size <= m_ring.size()) {
+				Entry e;
+
+				// Only if the writer is a whole ring behind
+				while (!ring_alloc(size, e.offset)) {
+					m_cv.wait(lock);
+				}
+
+				e.size = size;
+				e.seq = st.seq;
+				e.frame_number = st.frame_number;
+				e.timestamp = st.timestamp;
+				memcpy(m_ring.data() + e.offset, packed.data(), size);
+				m_entries.push_back(e);
+			}
+
+			m_packed = st.seq + 1;
+		}
+
+		m_cv.notify_all();
+
+		{
+			std::lock_guard<std::mutex> lock(m_stage_mutex);
+			m_stage_free.push_back(slot);
+		}
+	}
+}
+
+void EventBuffer::trigger(const char* reason) {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_event_pending) {
+			return;
+		}
+
+		m_event_pending = true;
+		m_event_first = m_pushed > (uint64_t)m_pre ? m_pushed - m_pre : 0;
+		m_event_end = m_pushed + m_post;
+		m_event_reason = reason;
+	}
+
+	m_cv.notify_all();
+}
+
+void EventBuffer::install_signal_trigger() {
+#ifndef WIN32
+	signal(SIGUSR1, trigger_signal_handler);
+#endif
+}
+
+void EventBuffer::poll_signal_trigger() {
+	if (g_signal_trigger) {
+		g_signal_trigger = 0;
+		trigger("SIGUSR1");
+	}
+}
+
+void EventBuffer::writer_main() {
+	std::vector<Entry> batch;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true) {
+		m_cv.wait(lock, [&] { return m_quit || m_event_pending; });
+		if (!m_event_pending) {
+			return;
+		}
+
+		uint64_t number = m_events++;
+		std::ostringstream path;
+		path << m_dir << "/event_" << number << ".rec";
+		std::cout << "Event " << number << " (" << m_event_reason << "), saving frames "
+			<< m_event_first << " - " << m_event_end << " to " << path.str() << std::endl;
+
+		lock.unlock();
+
+		// Own recorder per event, so every event gets its own index journal
+		size_t max_size = sizeof(EventFrameHeader) + m_max_depth_size / 2 * 3 + m_max_color_size;
+		Recorder recorder(max_size, 8);
+		bool ok = recorder.open(path.str());
+
+		lock.lock();
+
+		uint64_t seq = m_event_first;
+		while (ok && seq < m_event_end) {
+			// Post event frames are written as they are packed. Once stopped
+			// nothing more is coming, the event ends with what there is.
+			m_cv.wait(lock, [&] { return m_quit || m_packed > seq; });
+			if (m_packed <= seq) {
+				break;
+			}
+
+			// Take everything packed so far. Entries are in seq order, but
+			// evicted or dropped ones leave gaps.
+			uint64_t end = std::min(m_packed, m_event_end);
+			std::deque<Entry>::const_iterator it = std::lower_bound(m_entries.begin(), m_entries.end(), seq,
+				[](const Entry& e, uint64_t s) { return e.seq < s; });
+
+			batch.clear();
+			for (; it != m_entries.end() && it->seq < end; ++it) {
+				batch.push_back(*it);
+			}
+
+			m_lost += (end - seq) - batch.size();
+			seq = end;
+
+			if (batch.empty()) {
+				continue;
+			}
+
+			// Pinned, the packer leaves the batch in place while it is
+			// written straight from the ring
+			m_pin_seq = batch.front().seq;
+			lock.unlock();
+
+			for (size_t i = 0; i < batch.size(); i++) {
+				const Entry& e = batch[i];
+				while (!recorder.submit(m_ring.data() + e.offset, e.size, e.frame_number, e.timestamp)) {
+					recorder.flush();
+				}
+				m_saved++;
+			}
+
+			lock.lock();
+			m_pin_seq = UINT64_MAX;
+			m_cv.notify_all();
+		}
+
+		lock.unlock();
+		recorder.close();
+		lock.lock();
+
+		m_event_pending = false;
+	}
+}
+
+bool EventBuffer::listen_udp(int port, int wake_fd) {
+#ifndef WIN32
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		std::cout << "Failed binding event trigger port " << port << std::endl;
+		close(fd);
+		return false;
+	}
+
+	m_udp_fd = fd;
+	m_udp = std::thread(&EventBuffer::udp_main, this, fd, wake_fd);
+	return true;
+#else
+	(void)port;
+	(void)wake_fd;
+	return false;
+#endif
+}
+
+void EventBuffer::udp_main(int fd, int wake_fd) {
+#ifndef WIN32
+	while (true) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (m_quit) {
+				return;
+			}
+		}
+
+		// wake_fd ends listening right away; the timeout only matters for
+		// stop() without it
+		struct pollfd p[2];
+		p[0].fd = fd;
+		p[0].events = POLLIN;
+		p[0].revents = 0;
+		p[1].fd = wake_fd;
+		p[1].events = POLLIN;
+		p[1].revents = 0;
+		if (poll(p, wake_fd >= 0 ? 2 : 1, 200) <= 0) {
+			continue;
+		}
+
+		if (p[1].revents) {
+			return;
+		}
+
+		char buf[64];
+		ssize_t n = recv(fd, buf, sizeof(buf), 0);
+		if (n >= 7 && memcmp(buf, "trigger", 7) == 0) {
+			trigger("udp");
+		}
+	}
+#else
+	(void)fd;
+	(void)wake_fd;
+#endif
+}
+
+void EventBuffer::print_stats() {
+	std::cout << "event buffer: " << buffered() << " framesets in " << m_ring.size() / (1024 * 1024) << " MiB, "
+		<< m_events << " events, " << m_saved << " frames saved, "
+		<< m_lost << " lost, " << m_skipped << " skipped while busy" << std::endl;
+}
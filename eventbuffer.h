@@ -0,0 +1,186 @@
+#ifndef EVENTBUFFER_H__
+#define EVENTBUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Payload layout of the records of an event recording: this header, then
+ * the depth frame (compressed if flagged), then the color frame as received.
+ */
+struct EventFrameHeader {
+	uint32_t depth_size;
+	uint32_t color_size;
+	uint32_t depth_compressed;
+	uint32_t reserved;
+};
+
+/**
+ * Rolling in-memory buffer of the latest depth / color framesets, of which
+ * the frames around an event are persisted to disk.
+ *
+ * push() only copies the frameset into one of a few staging slots; a packer
+ * thread moves it into a ring of budget bytes, delta coding depth on the way
+ * if compression is on. Framesets take as much of the ring as they need, the
+ * oldest ones are evicted to make room, so compressed framesets keep more
+ * history in the same memory.
+ *
+ * On trigger() the pre_frames framesets before it and the post_frames after
+ * it are written by a background thread into one Recorder file per event,
+ * <directory>/event_<number>.rec, straight from the ring; the packer only
+ * waits for it if it fell a whole ring behind. Capture never waits for
+ * either thread: push() skips the frameset if every staging slot is busy,
+ * and framesets evicted before the writer got to them are counted as lost.
+ */
+class EventBuffer {
+public:
+	EventBuffer(size_t max_depth_size, size_t max_color_size, size_t budget, int pre_frames, int post_frames,
+		bool compress);
+	virtual ~EventBuffer();
+
+	/**
+	 * Directory events are written to, current directory by default
+	 */
+	void set_directory(const std::string& dir);
+
+	/**
+	 * Add a frameset, color may be NULL. Called from the capture thread,
+	 * copies the frames and returns.
+	 */
+	void push(const uint16_t* depth, size_t depth_size, const unsigned char* color, size_t color_size,
+		uint64_t frame_number, double timestamp);
+
+	/**
+	 * Persist the frames around now. Ignored while an event is being written.
+	 * Thread safe.
+	 */
+	void trigger(const char* reason);
+
+	/**
+	 * Trigger events on SIGUSR1. Where there are no signals this does nothing.
+	 */
+	static void install_signal_trigger();
+
+	/**
+	 * Trigger if SIGUSR1 arrived since the previous call. Called from the
+	 * capture loop, as the signal handler cannot do it itself.
+	 */
+	void poll_signal_trigger();
+
+	/**
+	 * Trigger on every UDP datagram starting with "trigger" to port on
+	 * localhost. Listening ends as soon as wake_fd becomes readable, e.g.
+	 * Shutdown::fd(). Returns false if the port cannot be bound.
+	 */
+	bool listen_udp(int port, int wake_fd = -1);
+
+	/**
+	 * Finish the pending event with the framesets already pushed and stop
+	 * the threads. push() must not be called anymore. The destructor does
+	 * this if it was not done before.
+	 */
+	void stop();
+
+	uint64_t events() const { return m_events; }
+	uint64_t saved() const { return m_saved; }
+	uint64_t lost() const { return m_lost; }
+
+	/** Framesets currently held in the ring */
+	size_t buffered();
+
+	void print_stats();
+
+	/**
+	 * Decode a depth frame compressed by the buffer, n pixels into depth.
+	 * Returns false if the data is malformed.
+	 */
+	static bool decompress_depth(const unsigned char* data, size_t size, uint16_t* depth, size_t n);
+
+private:
+	// Uncompressed frameset waiting for the packer
+	struct Staging {
+		std::vector<uint16_t> depth;
+		std::vector<unsigned char> color;
+		size_t depth_size;
+		size_t color_size;
+		uint64_t seq;
+		uint64_t frame_number;
+		double timestamp;
+	};
+
+	// Packed frameset in the ring: EventFrameHeader, depth, color
+	struct Entry {
+		size_t offset;
+		size_t size;
+		uint64_t seq;
+		uint64_t frame_number;
+		double timestamp;
+	};
+
+	void packer_main();
+	void writer_main();
+	void udp_main(int fd, int wake_fd);
+
+	/**
+	 * Room for size bytes in the ring at pos, evicting the oldest entries.
+	 * Returns false and changes nothing if that would evict a pinned entry.
+	 * Called with m_mutex held.
+	 */
+	bool ring_alloc(size_t size, size_t& pos);
+
+	int m_pre;
+	int m_post;
+	bool m_compress;
+	size_t m_max_depth_size;
+	size_t m_max_color_size;
+	std::string m_dir;
+
+	// Staging slots, free and filled ones in push order, guarded by m_stage_mutex
+	std::vector<Staging> m_staging;
+	std::vector<int> m_stage_free;
+	std::deque<int> m_stage_filled;
+	std::mutex m_stage_mutex;
+	std::condition_variable m_stage_cv;
+	bool m_stage_quit;
+	std::thread m_packer;
+
+	// Ring of packed framesets, guarded by m_mutex. Entries are in seq order.
+	std::vector<unsigned char> m_ring;
+	std::deque<Entry> m_entries;
+	size_t m_ring_head;
+
+	// Entries from this seq on are being written out of the ring without
+	// the lock and must not be evicted, UINT64_MAX if none
+	uint64_t m_pin_seq;
+
+	// framesets pushed, and packed or dropped by the packer, guarded by m_mutex
+	uint64_t m_pushed;
+	uint64_t m_packed;
+
+	// pending event: frames [m_event_first, m_event_end)
+	bool m_event_pending;
+	uint64_t m_event_first;
+	uint64_t m_event_end;
+	std::string m_event_reason;
+
+	std::thread m_writer;
+	std::thread m_udp;
+	int m_udp_fd;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_quit;
+
+	std::atomic<uint64_t> m_events;
+	std::atomic<uint64_t> m_saved;
+	std::atomic<uint64_t> m_lost;
+	std::atomic<uint64_t> m_skipped;
+};
+
+#endif // EVENTBUFFER_H__
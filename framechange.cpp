@@ -0,0 +1,168 @@
+#include "framechange.h"
+
+#include <string.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRAMECHANGE_USE_SSE2 1
+#endif
+
+static inline int popcount16(unsigned int v) {
+	v = v - ((v >> 1) & 0x5555);
+	v = (v & 0x3333) + ((v >> 2) & 0x3333);
+	v = (v + (v >> 4)) & 0x0f0f;
+	return (v + (v >> 8)) & 0x1f;
+}
+
+TileChangeMap::TileChangeMap(int w, int h, int tile_size) {
+	m_w = w;
+	m_h = h;
+	m_tile_size = tile_size;
+	m_tiles_x = (w + tile_size - 1) / tile_size;
+	m_tiles_y = (h + tile_size - 1) / tile_size;
+	m_changed.resize(m_tiles_x * m_tiles_y);
+	m_acc.resize(m_tiles_x);
+
+	m_depth_threshold = 30;
+	m_min_pixels = 8;
+	m_color_threshold = 6;
+
+	m_invalid = true;
+	mark_all();
+}
+
+void TileChangeMap::mark_all() {
+	memset(m_changed.data(), 1, m_changed.size());
+	m_changed_tiles = tile_count();
+}
+
+void TileChangeMap::clear() {
+	memset(m_changed.data(), 0, m_changed.size());
+	m_changed_tiles = 0;
+}
+
+/**
+ * Counts pixels of one row span which moved more than threshold, copying them over
+ */
+static uint32_t copy_depth_span(uint16_t* dst, const uint16_t* src, int n, uint16_t threshold) {
+	uint32_t moved = 0;
+	int i = 0;
+
+#ifdef FRAMECHANGE_USE_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i thr = _mm_set1_epi16((short)threshold);
+
+	for (; i + 8 <= n; i += 8) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), s);
+
+		__m128i diff = _mm_or_si128(_mm_subs_epu16(s, d), _mm_subs_epu16(d, s));
+		__m128i within = _mm_cmpeq_epi16(_mm_subs_epu16(diff, thr), zero);
+
+		// two mask bits per 16 bit lane
+		moved += 8 - popcount16(_mm_movemask_epi8(within)) / 2;
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint16_t s = src[i];
+		uint16_t d = dst[i];
+		uint16_t diff = s > d ? s - d : d - s;
+		if (diff > threshold) {
+			moved++;
+		}
+		dst[i] = s;
+	}
+
+	return moved;
+}
+
+/**
+ * Sum of absolute differences of one row span of bytes, copying them over
+ */
+static uint32_t copy_bytes_span(unsigned char* dst, const unsigned char* src, int n) {
+	uint32_t sad = 0;
+	int i = 0;
+
+#ifdef FRAMECHANGE_USE_SSE2
+	__m128i acc = _mm_setzero_si128();
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+		_mm_storeu_si128((__m128i*)(dst + i), s);
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(s, d));
+	}
+
+	sad += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+#endif
+
+	for (; i < n; i++) {
+		sad += src[i] > dst[i] ? src[i] - dst[i] : dst[i] - src[i];
+		dst[i] = src[i];
+	}
+
+	return sad;
+}
+
+void copy_depth_tracked(uint16_t* dst, const uint16_t* src, TileChangeMap& tiles) {
+	const int w = tiles.m_w;
+	const int ts = tiles.m_tile_size;
+	int changed_tiles = 0;
+
+	for (int ty = 0; ty < tiles.m_tiles_y; ty++) {
+		int y_end = std::min((ty + 1) * ts, tiles.m_h);
+		std::fill(tiles.m_acc.begin(), tiles.m_acc.end(), 0);
+
+		for (int y = ty * ts; y < y_end; y++) {
+			for (int tx = 0; tx < tiles.m_tiles_x; tx++) {
+				int x0 = tx * ts;
+				int off = y * w + x0;
+				tiles.m_acc[tx] += copy_depth_span(dst + off, src + off,
+					std::min(ts, w - x0), tiles.m_depth_threshold);
+			}
+		}
+
+		for (int tx = 0; tx < tiles.m_tiles_x; tx++) {
+			bool changed = tiles.m_invalid || tiles.m_acc[tx] > (uint32_t)tiles.m_min_pixels;
+			tiles.m_changed[ty * tiles.m_tiles_x + tx] = changed;
+			changed_tiles += changed;
+		}
+	}
+
+	tiles.m_changed_tiles = changed_tiles;
+	tiles.m_invalid = false;
+}
+
+void copy_color_tracked(unsigned char* dst, const unsigned char* src, TileChangeMap& tiles) {
+	const int stride = tiles.m_w * 3;
+	const int ts = tiles.m_tile_size;
+	int changed_tiles = 0;
+
+	for (int ty = 0; ty < tiles.m_tiles_y; ty++) {
+		int y_end = std::min((ty + 1) * ts, tiles.m_h);
+		std::fill(tiles.m_acc.begin(), tiles.m_acc.end(), 0);
+
+		for (int y = ty * ts; y < y_end; y++) {
+			for (int tx = 0; tx < tiles.m_tiles_x; tx++) {
+				int x0 = tx * ts;
+				int off = y * stride + x0 * 3;
+				tiles.m_acc[tx] += copy_bytes_span(dst + off, src + off,
+					std::min(ts, tiles.m_w - x0) * 3);
+			}
+		}
+
+		for (int tx = 0; tx < tiles.m_tiles_x; tx++) {
+			uint32_t tile_bytes = std::min(ts, tiles.m_w - tx * ts) * (y_end - ty * ts) * 3;
+			bool changed = tiles.m_invalid ||
+				tiles.m_acc[tx] > (uint32_t)tiles.m_color_threshold * tile_bytes;
+			tiles.m_changed[ty * tiles.m_tiles_x + tx] = changed;
+			changed_tiles += changed;
+		}
+	}
+
+	tiles.m_changed_tiles = changed_tiles;
+	tiles.m_invalid = false;
+}
@@ -0,0 +1,75 @@
+#ifndef FRAMECHANGE_H__
+#define FRAMECHANGE_H__
+
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Per-tile change flags of an image, filled while copying a new frame over
+ * the previous one. Stages and publishers can use these to skip or
+ * delta-encode tiles which did not change.
+ */
+class TileChangeMap {
+public:
+	TileChangeMap(int w, int h, int tile_size);
+
+	int tile_size() const { return m_tile_size; }
+	int tiles_x() const { return m_tiles_x; }
+	int tiles_y() const { return m_tiles_y; }
+	int tile_count() const { return m_tiles_x * m_tiles_y; }
+
+	bool changed(int tx, int ty) const { return m_changed[ty * m_tiles_x + tx] != 0; }
+	int changed_tiles() const { return m_changed_tiles; }
+	bool any_changed() const { return m_changed_tiles > 0; }
+
+	/**
+	 * Mark every tile as changed, e.g. for the first frame or after the
+	 * previous contents of the destination buffer became invalid.
+	 */
+	void mark_all();
+
+	/**
+	 * Mark every tile as unchanged, for frames known to be identical to the
+	 * previous one
+	 */
+	void clear();
+
+	/**
+	 * Request that the next tracked copy marks every tile as changed
+	 */
+	void invalidate() { m_invalid = true; }
+
+	// Depth: a tile changes once more than m_min_pixels pixels moved more than m_depth_threshold
+	uint16_t m_depth_threshold;
+	int m_min_pixels;
+
+	// Color: a tile changes once its mean absolute difference per byte exceeds this
+	int m_color_threshold;
+
+private:
+	friend void copy_depth_tracked(uint16_t*, const uint16_t*, TileChangeMap&);
+	friend void copy_color_tracked(unsigned char*, const unsigned char*, TileChangeMap&);
+
+	int m_w;
+	int m_h;
+	int m_tile_size;
+	int m_tiles_x;
+	int m_tiles_y;
+	int m_changed_tiles;
+	bool m_invalid;
+	std::vector<uint8_t> m_changed;
+	std::vector<uint32_t> m_acc;
+};
+
+/**
+ * memcpy replacement for Z16 frames. dst must hold the previous frame, it is
+ * compared against src while being overwritten, filling tiles.
+ */
+void copy_depth_tracked(uint16_t* dst, const uint16_t* src, TileChangeMap& tiles);
+
+/**
+ * memcpy replacement for RGB8 frames, see copy_depth_tracked()
+ */
+void copy_color_tracked(unsigned char* dst, const unsigned char* src, TileChangeMap& tiles);
+
+#endif // FRAMECHANGE_H__
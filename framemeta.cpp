@@ -0,0 +1,108 @@
+#include "framemeta.h"
+
+#include <math.h>
+#include <iostream>
+
+
+static float metadata_or(const rs2::frame& f, rs2_frame_metadata_value key, float def) {
+	if (!f.supports_frame_metadata(key)) {
+		return def;
+	}
+
+	return (float)f.get_frame_metadata(key);
+}
+
+FrameMetadata FrameMetadata::read(const rs2::frame& f) {
+	FrameMetadata m;
+	m.frame_number = f.get_frame_number();
+	m.timestamp = f.get_timestamp();
+	m.arrival = std::chrono::steady_clock::now();
+	m.exposure = metadata_or(f, RS2_FRAME_METADATA_ACTUAL_EXPOSURE, NAN);
+	m.gain = metadata_or(f, RS2_FRAME_METADATA_GAIN_LEVEL, NAN);
+	m.laser_power = metadata_or(f, RS2_FRAME_METADATA_FRAME_LASER_POWER, NAN);
+	m.emitter = (int)metadata_or(f, RS2_FRAME_METADATA_FRAME_LASER_POWER_MODE, -1.0f);
+	m.auto_exposure = (int)metadata_or(f, RS2_FRAME_METADATA_AUTO_EXPOSURE, -1.0f);
+	return m;
+}
+
+MetadataMonitor::MetadataMonitor(size_t history_size) {
+	FrameMetadata empty;
+	empty.frame_number = 0;
+	empty.timestamp = 0.0;
+	empty.exposure = NAN;
+	empty.gain = NAN;
+	empty.laser_power = NAN;
+	empty.emitter = -1;
+	empty.auto_exposure = -1;
+
+	m_history.assign(history_size > 0 ? history_size : 1, empty);
+	m_observed = 0;
+}
+
+MetadataMonitor::Predicate MetadataMonitor::auto_exposure_is(bool on) {
+	int want = on ? 1 : 0;
+	return [want](const FrameMetadata& m) { return m.auto_exposure == want; };
+}
+
+MetadataMonitor::Predicate MetadataMonitor::emitter_is(bool on) {
+	return [on](const FrameMetadata& m) { return m.emitter >= 0 && (m.emitter > 0) == on; };
+}
+
+MetadataMonitor::Predicate MetadataMonitor::any_frame() {
+	return [](const FrameMetadata&) { return true; };
+}
+
+void MetadataMonitor::observe(const rs2::frame& f) {
+	rs2::frame depth = f;
+	if (f.is<rs2::frameset>()) {
+		depth = f.as<rs2::frameset>().get_depth_frame();
+	}
+
+	if (!depth || depth.get_profile().stream_type() != RS2_STREAM_DEPTH) {
+		return;
+	}
+
+	FrameMetadata m = FrameMetadata::read(depth);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_history[m_observed % m_history.size()] = m;
+	m_observed++;
+}
+
+uint64_t MetadataMonitor::mark() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_observed;
+}
+
+bool MetadataMonitor::poll(uint64_t& checked, const Predicate& pred, FrameMetadata* out) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	// Frames that already fell out of the history are skipped
+	if (m_observed - checked > m_history.size()) {
+		checked = m_observed - m_history.size();
+	}
+
+	while (checked < m_observed) {
+		const FrameMetadata& m = m_history[checked % m_history.size()];
+		checked++;
+
+		if (pred(m)) {
+			if (out) {
+				*out = m;
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+FrameMetadata MetadataMonitor::latest() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_history[(m_observed + m_history.size() - 1) % m_history.size()];
+}
+
+uint64_t MetadataMonitor::observed() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_observed;
+}
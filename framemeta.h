@@ -0,0 +1,80 @@
+#ifndef FRAMEMETA_H__
+#define FRAMEMETA_H__
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+/**
+ * Sensor state a depth frame was exposed with, from its metadata. Values the
+ * frame does not report are NaN, or -1 for the flags.
+ */
+struct FrameMetadata {
+	uint64_t frame_number;
+	double timestamp;
+	std::chrono::steady_clock::time_point arrival;
+	float exposure;       // us
+	float gain;
+	float laser_power;
+	int emitter;          // laser power mode, 1 if the projector was on
+	int auto_exposure;
+
+	static FrameMetadata read(const rs2::frame& f);
+};
+
+/**
+ * Tracks the metadata of depth frames as they arrive, so control commands
+ * can be confirmed by the first frame they apply to instead of sleeping.
+ *
+ * observe() is called from the frame callback, ahead of any queue the
+ * capture loop reads from. The last history_size frames are kept, so poll()
+ * checks every frame after its marker even if several arrived since the
+ * previous call.
+ */
+class MetadataMonitor {
+public:
+	typedef std::function<bool(const FrameMetadata&)> Predicate;
+
+	MetadataMonitor(size_t history_size = 64);
+
+	/**
+	 * Conditions for poll. Frames not reporting the value never match.
+	 */
+	static Predicate auto_exposure_is(bool on);
+	static Predicate emitter_is(bool on);
+	static Predicate any_frame();
+
+	/**
+	 * Record a depth frame, or the depth frame of a frameset
+	 */
+	void observe(const rs2::frame& f);
+
+	/**
+	 * Marker for waiting on frames arriving from now on, taken right before
+	 * sending a command
+	 */
+	uint64_t mark();
+
+	/**
+	 * Check the frames after checked for one matching pred, advancing checked
+	 * past them. Start with checked at a marker. Returns true and the
+	 * matching frame in out once found; never blocks.
+	 */
+	bool poll(uint64_t& checked, const Predicate& pred, FrameMetadata* out = NULL);
+
+	FrameMetadata latest();
+	uint64_t observed();
+
+private:
+	std::mutex m_mutex;
+
+	// frame n (counting from 1) is at m_history[(n - 1) % size]
+	std::vector<FrameMetadata> m_history;
+	uint64_t m_observed;
+};
+
+#endif // FRAMEMETA_H__
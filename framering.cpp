@@ -0,0 +1,84 @@
+#include "framering.h"
+
+#include <string.h>
+
+FrameRing::FrameRing(size_t frame_size, int slots, unsigned char* storage) {
+	if (storage == NULL) {
+		m_own.resize(frame_size * slots);
+		storage = m_own.data();
+	}
+
+	m_frame_size = frame_size;
+	m_slots.resize(slots);
+	for (int i = 0; i < slots; i++) {
+		m_slots[i].data = storage + frame_size * i;
+		m_slots[i].size = 0;
+		m_slots[i].frame_number = 0;
+		m_slots[i].timestamp = 0.0;
+	}
+
+	m_head = 0;
+	m_count = 0;
+	m_pushed = 0;
+}
+
+FrameRing::FrameRing(const FrameRing& other) {
+	*this = other;
+}
+
+FrameRing& FrameRing::operator=(const FrameRing& other) {
+	m_own = other.m_own;
+	m_slots = other.m_slots;
+	m_frame_size = other.m_frame_size;
+	m_head = other.m_head;
+	m_count = other.m_count;
+	m_pushed = other.m_pushed;
+	rebase(other);
+	return *this;
+}
+
+/**
+ * Point copied slots at our own copy of the buffers, if the ring owns them
+ */
+void FrameRing::rebase(const FrameRing& other) {
+	if (m_own.empty()) {
+		return;
+	}
+
+	for (size_t i = 0; i < m_slots.size(); i++) {
+		m_slots[i].data = m_own.data() + (other.m_slots[i].data - other.m_own.data());
+	}
+}
+
+bool FrameRing::push(const void* data, size_t size, uint64_t frame_number, double timestamp) {
+	if (m_slots.empty()) {
+		return false;
+	}
+
+	Slot& s = m_slots[m_head];
+	if (size > m_frame_size) {
+		return false;
+	}
+
+	memcpy(s.data, data, size);
+	s.size = size;
+	s.frame_number = frame_number;
+	s.timestamp = timestamp;
+
+	m_head = (m_head + 1) % m_slots.size();
+	if (m_count < (int)m_slots.size()) {
+		m_count++;
+	}
+	m_pushed++;
+
+	return true;
+}
+
+const FrameRing::Slot* FrameRing::at(int age) const {
+	if (age < 0 || age >= m_count) {
+		return NULL;
+	}
+
+	int n = (int)m_slots.size();
+	return &m_slots[(m_head - 1 - age + n) % n];
+}
@@ -0,0 +1,58 @@
+#ifndef FRAMERING_H__
+#define FRAMERING_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Fixed number of preallocated frame buffers, overwriting the oldest frame
+ * when full. Not thread safe.
+ *
+ * The buffers are either owned by the ring or carved out of caller provided
+ * storage of frame_size * slots bytes, e.g. from a NumaSlab, which must
+ * outlive the ring.
+ */
+class FrameRing {
+public:
+	struct Slot {
+		unsigned char* data;
+		size_t size;
+		uint64_t frame_number;
+		double timestamp;
+	};
+
+	FrameRing(size_t frame_size, int slots, unsigned char* storage = NULL);
+	FrameRing(const FrameRing& other);
+	FrameRing& operator=(const FrameRing& other);
+
+	/**
+	 * Copy a frame into the ring. Returns false if it is larger than the slots.
+	 */
+	bool push(const void* data, size_t size, uint64_t frame_number, double timestamp);
+
+	/**
+	 * Frame pushed age pushes ago, 0 being the latest. NULL if there is no such frame.
+	 */
+	const Slot* at(int age) const;
+	const Slot* latest() const { return at(0); }
+
+	/** Frames currently held */
+	int count() const { return m_count; }
+	int capacity() const { return (int)m_slots.size(); }
+
+	/** Frames pushed over the lifetime of the ring */
+	uint64_t pushed() const { return m_pushed; }
+
+private:
+	void rebase(const FrameRing& other);
+
+	std::vector<unsigned char> m_own;
+	std::vector<Slot> m_slots;
+	size_t m_frame_size;
+	int m_head;
+	int m_count;
+	uint64_t m_pushed;
+};
+
+#endif // FRAMERING_H__
@@ -0,0 +1,192 @@
+#include "heightmap.h"
+
+#include <math.h>
+#include <algorithm>
+
+static const float no_height = -1.0e9f;
+
+HeightMap::HeightMap(const rs2_intrinsics& intr, float depth_scale, WorkerPool& pool,
+	float cell_size, int cells_x, int cells_y, float x_min, float y_min) : m_pool(pool)
+{
+	m_w = intr.width;
+	m_h = intr.height;
+	m_depth_scale = depth_scale;
+	m_cell_size = cell_size;
+	m_cells_x = cells_x;
+	m_cells_y = cells_y;
+	m_x_min = x_min;
+	m_y_min = y_min;
+	m_occupied = 0;
+
+	m_obstacle_height = 0.10f;
+	m_max_height = 2.5f;
+	m_min_points = 4;
+
+	// D400 depth streams are undistorted, a per row / column ray table is exact
+	m_ray_x.resize(m_w);
+	m_ray_y.resize(m_h);
+
+	for (int u = 0; u < m_w; u++) {
+		m_ray_x[u] = (u - intr.ppx) / intr.fx;
+	}
+	for (int v = 0; v < m_h; v++) {
+		m_ray_y[v] = (v - intr.ppy) / intr.fy;
+	}
+
+	m_partials.resize(pool.size());
+	for (size_t i = 0; i < m_partials.size(); i++) {
+		m_partials[i].height.resize(cells_x * cells_y);
+		m_partials[i].count.resize(cells_x * cells_y);
+	}
+
+	m_height.resize(cells_x * cells_y);
+	m_count.resize(cells_x * cells_y);
+	m_occupancy.resize(cells_x * cells_y);
+
+	set_mount(1.0f, 0.0f);
+}
+
+void HeightMap::set_extrinsic(const float rotation[9], const float translation[3]) {
+	for (int i = 0; i < 9; i++) {
+		m_rot[i] = rotation[i];
+	}
+	for (int i = 0; i < 3; i++) {
+		m_trans[i] = translation[i];
+	}
+}
+
+void HeightMap::set_mount(float height, float pitch) {
+	// Columns are the camera axes (x right, y down, z forward) in world coordinates
+	float s = sinf(pitch);
+	float c = cosf(pitch);
+	float rot[9] = {
+		0.0f, -s, c,
+		-1.0f, 0.0f, 0.0f,
+		0.0f, -c, -s
+	};
+	float trans[3] = { 0.0f, 0.0f, height };
+	set_extrinsic(rot, trans);
+}
+
+bool HeightMap::set_floor_plane(float nx, float ny, float nz, float d) {
+	float len = sqrtf(nx * nx + ny * ny + nz * nz);
+	if (len < 1.0e-6f) {
+		return false;
+	}
+
+	nx /= len;
+	ny /= len;
+	nz /= len;
+	d /= len;
+
+	// world x: camera forward axis projected onto the floor
+	float fx = -nz * nx;
+	float fy = -nz * ny;
+	float fz = 1.0f - nz * nz;
+	float flen = sqrtf(fx * fx + fy * fy + fz * fz);
+	if (flen < 1.0e-6f) {
+		// camera looks straight down, no forward direction on the floor
+		return false;
+	}
+
+	fx /= flen;
+	fy /= flen;
+	fz /= flen;
+
+	// world y = z x x
+	float rot[9] = {
+		fx, fy, fz,
+		ny * fz - nz * fy, nz * fx - nx * fz, nx * fy - ny * fx,
+		nx, ny, nz
+	};
+	float trans[3] = { 0.0f, 0.0f, d };
+	set_extrinsic(rot, trans);
+	return true;
+}
+
+void HeightMap::accumulate(Partial& p, int y0, int y1, const uint16_t* depth) {
+	const float* r = m_rot;
+	const float inv_cell = 1.0f / m_cell_size;
+	float* height = p.height.data();
+	int* count = p.count.data();
+
+	std::fill(p.height.begin(), p.height.end(), no_height);
+	std::fill(p.count.begin(), p.count.end(), 0);
+
+	for (int v = y0; v < y1; v++) {
+		const uint16_t* row = depth + v * m_w;
+		const float ry = m_ray_y[v];
+
+		for (int u = 0; u < m_w; u++) {
+			if (row[u] == 0) {
+				continue;
+			}
+
+			float z = row[u] * m_depth_scale;
+			float x = m_ray_x[u] * z;
+			float y = ry * z;
+
+			float wz = r[6] * x + r[7] * y + r[8] * z + m_trans[2];
+			if (wz > m_max_height) {
+				continue;
+			}
+
+			float wx = r[0] * x + r[1] * y + r[2] * z + m_trans[0];
+			float wy = r[3] * x + r[4] * y + r[5] * z + m_trans[1];
+
+			int cx = (int)floorf((wx - m_x_min) * inv_cell);
+			int cy = (int)floorf((wy - m_y_min) * inv_cell);
+			if (cx < 0 || cy < 0 || cx >= m_cells_x || cy >= m_cells_y) {
+				continue;
+			}
+
+			int cell = cy * m_cells_x + cx;
+			if (wz > height[cell]) {
+				height[cell] = wz;
+			}
+			count[cell]++;
+		}
+	}
+}
+
+void HeightMap::update(const uint16_t* depth) {
+	const int parts = (int)m_partials.size();
+
+	m_pool.parallel_for(parts, [&](int i) {
+		accumulate(m_partials[i], m_h * i / parts, m_h * (i + 1) / parts, depth);
+	});
+
+	const int cells = m_cells_x * m_cells_y;
+	std::vector<int> occupied(parts, 0);
+
+	m_pool.parallel_for(parts, [&](int i) {
+		int c_end = cells * (i + 1) / parts;
+
+		for (int c = cells * i / parts; c < c_end; c++) {
+			float h = no_height;
+			int n = 0;
+
+			for (int k = 0; k < parts; k++) {
+				h = std::max(h, m_partials[k].height[c]);
+				n += m_partials[k].count[c];
+			}
+
+			m_count[c] = n;
+			m_height[c] = n > 0 ? h : 0.0f;
+
+			if (n < m_min_points) {
+				m_occupancy[c] = CELL_UNKNOWN;
+			} else if (h >= m_obstacle_height) {
+				m_occupancy[c] = CELL_OCCUPIED;
+				occupied[i]++;
+			} else {
+				m_occupancy[c] = CELL_FREE;
+			}
+		}
+	});
+
+	m_occupied = 0;
+	for (int i = 0; i < parts; i++) {
+		m_occupied += occupied[i];
+	}
+}
@@ -0,0 +1,102 @@
+#ifndef HEIGHTMAP_H__
+#define HEIGHTMAP_H__
+
+#include <stdint.h>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+#include "workerpool.h"
+
+/**
+ * Top-down 2.5D height map generated from depth frames.
+ *
+ * Depth pixels are deprojected into camera space and transformed into a world
+ * frame where x points forward, y left and z up from the floor. Points are
+ * binned into a fixed grid of square cells on the x/y plane, keeping the
+ * highest point and the amount of points per cell.
+ *
+ * Rows of the depth image are split between the worker pool threads, each
+ * accumulating into its own partial grid. Partial grids are merged at the end.
+ */
+class HeightMap {
+public:
+	enum Occupancy {
+		CELL_UNKNOWN = 0,
+		CELL_FREE = 1,
+		CELL_OCCUPIED = 2
+	};
+
+	/**
+	 * Grid covers x_min .. x_min + cells_x * cell_size and
+	 * y_min .. y_min + cells_y * cell_size, in meters
+	 */
+	HeightMap(const rs2_intrinsics& intr, float depth_scale, WorkerPool& pool,
+		float cell_size, int cells_x, int cells_y, float x_min, float y_min);
+
+	/**
+	 * Camera to world transform, row-major rotation and translation in meters
+	 */
+	void set_extrinsic(const float rotation[9], const float translation[3]);
+
+	/**
+	 * Extrinsic for a camera mounted height meters above the floor, looking
+	 * forward and tilted down by pitch radians
+	 */
+	void set_mount(float height, float pitch);
+
+	/**
+	 * Extrinsic from a floor plane n . p + d = 0 in camera coordinates, with the
+	 * normal n pointing from the floor towards the camera (d > 0)
+	 */
+	bool set_floor_plane(float nx, float ny, float nz, float d);
+
+	void update(const uint16_t* depth);
+
+	int cells_x() const { return m_cells_x; }
+	int cells_y() const { return m_cells_y; }
+
+	/** Highest point per cell in meters above the floor, 0 without points. Row-major by y */
+	const float* max_height() const { return m_height.data(); }
+	const int* point_count() const { return m_count.data(); }
+	const uint8_t* occupancy() const { return m_occupancy.data(); }
+	int occupied_cells() const { return m_occupied; }
+
+	// Points at or above this height make a cell an obstacle
+	float m_obstacle_height;
+
+	// Points above this height (e.g. ceiling) are ignored
+	float m_max_height;
+
+	// Cells need this many points to be considered observed
+	int m_min_points;
+
+private:
+	struct Partial {
+		std::vector<float> height;
+		std::vector<int> count;
+	};
+
+	void accumulate(Partial& p, int y0, int y1, const uint16_t* depth);
+
+	int m_w;
+	int m_h;
+	float m_depth_scale;
+	WorkerPool& m_pool;
+	float m_cell_size;
+	int m_cells_x;
+	int m_cells_y;
+	float m_x_min;
+	float m_y_min;
+	float m_rot[9];
+	float m_trans[3];
+	std::vector<float> m_ray_x;
+	std::vector<float> m_ray_y;
+	std::vector<Partial> m_partials;
+	std::vector<float> m_height;
+	std::vector<int> m_count;
+	std::vector<uint8_t> m_occupancy;
+	int m_occupied;
+};
+
+#endif // HEIGHTMAP_H__
@@ -0,0 +1,198 @@
+#include "imu.h"
+
+#include <math.h>
+
+static Quat quat_mul(const Quat& a, const Quat& b) {
+	Quat r;
+	r.w = a.w * b.w - a.x * b.x - a.y * b.y - a.z * b.z;
+	r.x = a.w * b.x + a.x * b.w + a.y * b.z - a.z * b.y;
+	r.y = a.w * b.y - a.x * b.z + a.y * b.w + a.z * b.x;
+	r.z = a.w * b.z + a.x * b.y - a.y * b.x + a.z * b.w;
+	return r;
+}
+
+static Quat quat_normalize(Quat q) {
+	float n = sqrtf(q.w * q.w + q.x * q.x + q.y * q.y + q.z * q.z);
+	if (n > 0.0f) {
+		q.w /= n;
+		q.x /= n;
+		q.y /= n;
+		q.z /= n;
+	}
+	return q;
+}
+
+/**
+ * Shortest rotation taking unit vector u onto unit vector v
+ */
+static Quat quat_from_vectors(const float u[3], const float v[3]) {
+	Quat q;
+	q.w = 1.0f + u[0] * v[0] + u[1] * v[1] + u[2] * v[2];
+
+	if (q.w < 1.0e-6f) {
+		// opposite vectors, rotate 180 degrees around any perpendicular axis
+		q.w = 0.0f;
+		if (fabsf(u[0]) > fabsf(u[2])) {
+			q.x = -u[1];
+			q.y = u[0];
+			q.z = 0.0f;
+		} else {
+			q.x = 0.0f;
+			q.y = -u[2];
+			q.z = u[1];
+		}
+	} else {
+		q.x = u[1] * v[2] - u[2] * v[1];
+		q.y = u[2] * v[0] - u[0] * v[2];
+		q.z = u[0] * v[1] - u[1] * v[0];
+	}
+
+	return quat_normalize(q);
+}
+
+ImuFusion::ImuFusion(size_t ring_capacity, size_t history) : m_ring(ring_capacity) {
+	m_dropped.store(0);
+	m_kp = 1.0f;
+
+	m_initialized = false;
+	m_q.w = 1.0f;
+	m_q.x = 0.0f;
+	m_q.y = 0.0f;
+	m_q.z = 0.0f;
+	m_last_gyro = 0.0;
+	m_have_accel = false;
+
+	m_history.resize(history);
+	m_history_head = 0;
+	m_history_count = 0;
+}
+
+void ImuFusion::push(const rs2::motion_frame& f) {
+	rs2_vector v = f.get_motion_data();
+
+	Sample s;
+	s.timestamp = f.get_timestamp();
+	s.gyro = f.get_profile().stream_type() == RS2_STREAM_GYRO;
+	s.x = v.x;
+	s.y = v.y;
+	s.z = v.z;
+
+	if (!m_ring.push(s)) {
+		m_dropped++;
+	}
+}
+
+int ImuFusion::update() {
+	Sample s;
+	int processed = 0;
+
+	while (m_ring.pop(s)) {
+		processed++;
+
+		if (s.gyro) {
+			integrate_gyro(s);
+			continue;
+		}
+
+		// Only trust the accelerometer as a gravity reference when not accelerating much
+		float n = sqrtf(s.x * s.x + s.y * s.y + s.z * s.z);
+		if (n < 7.8f || n > 11.8f) {
+			continue;
+		}
+
+		m_accel[0] = s.x / n;
+		m_accel[1] = s.y / n;
+		m_accel[2] = s.z / n;
+		m_have_accel = true;
+
+		if (!m_initialized) {
+			const float up[3] = { 0.0f, 0.0f, 1.0f };
+			m_q = quat_from_vectors(m_accel, up);
+			m_initialized = true;
+		}
+	}
+
+	return processed;
+}
+
+void ImuFusion::integrate_gyro(const Sample& s) {
+	double dt = (s.timestamp - m_last_gyro) / 1000.0;
+	m_last_gyro = s.timestamp;
+
+	// wait for the first accel sample, skip gaps and reordered samples
+	if (!m_initialized || dt <= 0.0 || dt > 0.1) {
+		return;
+	}
+
+	float wx = s.x;
+	float wy = s.y;
+	float wz = s.z;
+
+	if (m_have_accel) {
+		// estimated up direction in sensor coordinates: conj(q) * (0, 0, 1) * q
+		const Quat& q = m_q;
+		float vx = 2.0f * (q.x * q.z - q.w * q.y);
+		float vy = 2.0f * (q.w * q.x + q.y * q.z);
+		float vz = q.w * q.w - q.x * q.x - q.y * q.y + q.z * q.z;
+
+		const float* a = m_accel;
+		wx += m_kp * (a[1] * vz - a[2] * vy);
+		wy += m_kp * (a[2] * vx - a[0] * vz);
+		wz += m_kp * (a[0] * vy - a[1] * vx);
+	}
+
+	float h = (float)dt * 0.5f;
+	Quat dq;
+	dq.w = 1.0f;
+	dq.x = wx * h;
+	dq.y = wy * h;
+	dq.z = wz * h;
+
+	m_q = quat_normalize(quat_mul(m_q, dq));
+
+	State& st = m_history[m_history_head];
+	st.timestamp = s.timestamp;
+	st.q = m_q;
+
+	m_history_head = (m_history_head + 1) % m_history.size();
+	if (m_history_count < m_history.size()) {
+		m_history_count++;
+	}
+}
+
+bool ImuFusion::orientation_at(double t, Quat& q) const {
+	if (m_history_count == 0) {
+		return false;
+	}
+
+	const size_t n = m_history.size();
+
+	// walk back from the newest state, depth frames are usually recent
+	for (size_t age = 0; age < m_history_count; age++) {
+		const State& s0 = m_history[(m_history_head + n - 1 - age) % n];
+
+		if (s0.timestamp > t) {
+			continue;
+		}
+
+		if (age == 0) {
+			q = s0.q;
+			return true;
+		}
+
+		const State& s1 = m_history[(m_history_head + n - age) % n];
+		float k = (float)((t - s0.timestamp) / (s1.timestamp - s0.timestamp));
+
+		// normalized lerp, flipping to the same hemisphere first
+		float sign = s0.q.w * s1.q.w + s0.q.x * s1.q.x + s0.q.y * s1.q.y + s0.q.z * s1.q.z < 0.0f ? -1.0f : 1.0f;
+		Quat r;
+		r.w = s0.q.w * (1.0f - k) + sign * s1.q.w * k;
+		r.x = s0.q.x * (1.0f - k) + sign * s1.q.x * k;
+		r.y = s0.q.y * (1.0f - k) + sign * s1.q.y * k;
+		r.z = s0.q.z * (1.0f - k) + sign * s1.q.z * k;
+		q = quat_normalize(r);
+		return true;
+	}
+
+	return false;
+}
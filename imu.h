@@ -0,0 +1,89 @@
+#ifndef IMU_H__
+#define IMU_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+#include "spscring.h"
+
+struct Quat {
+	float w;
+	float x;
+	float y;
+	float z;
+};
+
+/**
+ * Orientation estimate from gyro and accel streams.
+ *
+ * Motion frames are pushed from the librealsense callback thread into a
+ * lock-free ring, so the callback never waits for the consumer. The consumer
+ * (the frame loop) drains the ring with update(), integrating gyro rates and
+ * correcting tilt drift towards the measured gravity direction (Mahony style
+ * complementary filter). Yaw is not observable without a magnetometer and
+ * drifts slowly.
+ *
+ * Orientations are kept in a short history, so that each depth frame can be
+ * given the orientation interpolated to its own timestamp.
+ */
+class ImuFusion {
+public:
+	ImuFusion(size_t ring_capacity, size_t history);
+
+	/**
+	 * Producer side, call from the frame callback with gyro / accel frames
+	 */
+	void push(const rs2::motion_frame& f);
+
+	/**
+	 * Consumer side: integrate every queued sample. Returns samples processed.
+	 */
+	int update();
+
+	/**
+	 * Orientation (sensor to world, world z up) at timestamp t in ms, in the
+	 * same clock domain as the motion frames. Returns false without data or
+	 * if t is older than the history. Timestamps newer than the latest sample
+	 * get the latest orientation.
+	 */
+	bool orientation_at(double t, Quat& q) const;
+
+	uint64_t dropped() const { return m_dropped.load(); }
+
+	// Gain pulling tilt towards the accelerometer, 1/s
+	float m_kp;
+
+private:
+	struct Sample {
+		double timestamp;
+		bool gyro;
+		float x;
+		float y;
+		float z;
+	};
+
+	struct State {
+		double timestamp;
+		Quat q;
+	};
+
+	void integrate_gyro(const Sample& s);
+
+	SpscRing<Sample> m_ring;
+	std::atomic<uint64_t> m_dropped;
+
+	bool m_initialized;
+	Quat m_q;
+	double m_last_gyro;
+	float m_accel[3];
+	bool m_have_accel;
+
+	std::vector<State> m_history;
+	size_t m_history_head;
+	size_t m_history_count;
+};
+
+#endif // IMU_H__
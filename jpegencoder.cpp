@@ -0,0 +1,197 @@
+#ifdef HAVE_TURBOJPEG
+
+#include "jpegencoder.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+#include <turbojpeg.h>
+
+JpegEncoder::JpegEncoder(int w, int h, int quality, int threads, int slots) {
+	m_w = w;
+	m_h = h;
+	m_quality = quality;
+	m_dropped = 0;
+	m_quit = false;
+	m_failed = false;
+
+	for (int i = 0; i < threads; i++) {
+		tjhandle tj = tjInitCompress();
+		if (tj == NULL) {
+			std::cout << "jpeg encoder " << i << ": tjInitCompress failed: " << tjGetErrorStr() << std::endl;
+			m_failed = true;
+			return;
+		}
+		m_handles.push_back(tj);
+	}
+
+	m_slots.resize(slots);
+	for (int i = 0; i < slots; i++) {
+		m_slots[i].rgb.resize(w * h * 3);
+		m_slots[i].jpeg.resize(tjBufSize(w, h, TJSAMP_420));
+		m_slots[i].frame_number = 0;
+		m_free.push_back(i);
+	}
+
+	m_stats.resize(threads);
+	for (int i = 0; i < threads; i++) {
+		m_stats[i].frames = 0;
+		m_stats[i].bytes = 0;
+		m_stats[i].busy_ms = 0.0;
+		m_threads.push_back(std::thread(&JpegEncoder::encoder_main, this, i));
+	}
+}
+
+JpegEncoder::~JpegEncoder() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+
+	m_cv.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i].join();
+	}
+
+	for (size_t i = 0; i < m_handles.size(); i++) {
+		tjDestroy((tjhandle)m_handles[i]);
+	}
+}
+
+void JpegEncoder::set_callback(const Callback& cb) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_callback = cb;
+}
+
+void JpegEncoder::flush() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_cv_idle.wait(lock, [&] { return m_free.size() == m_slots.size(); });
+}
+
+bool JpegEncoder::submit(const unsigned char* rgb, uint64_t frame_number) {
+	if (m_failed) {
+		return false;
+	}
+
+	int slot;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.empty()) {
+			m_dropped++;
+			return false;
+		}
+
+		slot = m_free.back();
+		m_free.pop_back();
+	}
+
+	// slot is owned by this thread until queued
+	memcpy(m_slots[slot].rgb.data(), rgb, m_w * m_h * 3);
+	m_slots[slot].frame_number = frame_number;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queued.push_back(slot);
+	}
+
+	m_cv.notify_one();
+	return true;
+}
+
+void JpegEncoder::encoder_main(int index) {
+	tjhandle tj = (tjhandle)m_handles[index];
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true) {
+		m_cv.wait(lock, [&] { return m_quit || !m_queued.empty(); });
+
+		if (m_quit) {
+			break;
+		}
+
+		int slot = m_queued.front();
+		m_queued.pop_front();
+		Callback cb = m_callback;
+		lock.unlock();
+
+		Slot& s = m_slots[slot];
+		unsigned char* out = s.jpeg.data();
+		unsigned long size = s.jpeg.size();
+
+		std::chrono::steady_clock::time_point t1 = std::chrono::steady_clock::now();
+
+		// TJFLAG_NOREALLOC: always compress into the preallocated slot buffer
+		int ret = tjCompress2(tj, s.rgb.data(), m_w, 0, m_h, TJPF_RGB, &out, &size,
+			TJSAMP_420, m_quality, TJFLAG_FASTDCT | TJFLAG_NOREALLOC);
+
+		std::chrono::steady_clock::time_point t2 = std::chrono::steady_clock::now();
+
+		if (ret != 0) {
+			std::cout << "jpeg encoder " << index << ": tjCompress2 failed: " << tjGetErrorStr2(tj) << std::endl;
+		} else if (cb) {
+			cb(out, size, s.frame_number);
+		}
+
+		lock.lock();
+		m_free.push_back(slot);
+		m_cv_idle.notify_all();
+
+		if (ret == 0) {
+			m_stats[index].frames++;
+			m_stats[index].bytes += size;
+			m_stats[index].busy_ms += std::chrono::duration<double, std::milli>(t2 - t1).count();
+		}
+	}
+}
+
+void JpegEncoder::print_stats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	for (size_t i = 0; i < m_stats.size(); i++) {
+		ThreadStats& st = m_stats[i];
+		if (st.frames == 0) {
+			continue;
+		}
+
+		std::cout << "jpeg encoder " << i << ": " << st.frames << " frames, "
+			<< (int)(st.frames * 1000.0 / st.busy_ms) << " fps per core, "
+			<< st.busy_ms / st.frames << " ms per frame, "
+			<< st.bytes / st.frames / 1024 << " KiB per frame" << std::endl;
+
+		st.frames = 0;
+		st.bytes = 0;
+		st.busy_ms = 0.0;
+	}
+
+	uint64_t dropped = m_dropped.load();
+	if (dropped) {
+		std::cout << "jpeg encoder: dropped " << dropped << " frames, all slots busy" << std::endl;
+	}
+}
+
+bool save_jpeg(const std::string& dir, const unsigned char* jpeg, unsigned long size, uint64_t frame_number) {
+	char name[64];
+	snprintf(name, sizeof(name), "/color_%08llu.jpg", (unsigned long long)frame_number);
+	std::string path = dir + name;
+
+	FILE* f = fopen(path.c_str(), "wb");
+	if (f == NULL) {
+		std::cout << "failed opening " << path << " for writing" << std::endl;
+		return false;
+	}
+
+	bool ok = fwrite(jpeg, 1, size, f) == size;
+	ok = fclose(f) == 0 && ok;
+
+	if (!ok) {
+		std::cout << "failed writing " << path << std::endl;
+	}
+
+	return ok;
+}
+
+#endif // HAVE_TURBOJPEG
@@ -0,0 +1,106 @@
+#ifndef JPEGENCODER_H__
+#define JPEGENCODER_H__
+
+#ifdef HAVE_TURBOJPEG
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Asynchronous RGB8 to JPEG compression with libjpeg-turbo.
+ *
+ * Frames are copied into one of a fixed number of slots and compressed by
+ * encoder threads, each owning a reusable TurboJPEG compressor handle. Slots
+ * own input and output buffers sized for the worst case, so steady state
+ * encoding does not allocate.
+ *
+ * The handles are created up front; if that fails no thread is started and
+ * failed() is true, submit() then rejects every frame.
+ */
+class JpegEncoder {
+public:
+	/**
+	 * Called from an encoder thread for every finished frame. The data is
+	 * only valid during the call.
+	 */
+	typedef std::function<void(const unsigned char* jpeg, unsigned long size, uint64_t frame_number)> Callback;
+
+	JpegEncoder(int w, int h, int quality, int threads, int slots);
+	virtual ~JpegEncoder();
+
+	/**
+	 * Queue a frame for compression. Returns false and drops the frame if
+	 * every slot is busy.
+	 */
+	bool submit(const unsigned char* rgb, uint64_t frame_number);
+
+	void set_callback(const Callback& cb);
+
+	/**
+	 * Wait until every submitted frame has been compressed
+	 */
+	void flush();
+
+	/**
+	 * Print throughput since the previous call: frames per second of busy
+	 * time per encoder thread, and output size
+	 */
+	void print_stats();
+
+	uint64_t dropped() const { return m_dropped.load(); }
+
+	/** No compressor could be created, nothing is encoded */
+	bool failed() const { return m_failed; }
+
+private:
+	struct Slot {
+		std::vector<unsigned char> rgb;
+		std::vector<unsigned char> jpeg;
+		uint64_t frame_number;
+	};
+
+	struct ThreadStats {
+		uint64_t frames;
+		uint64_t bytes;
+		double busy_ms;
+	};
+
+	void encoder_main(int index);
+
+	int m_w;
+	int m_h;
+	int m_quality;
+	bool m_failed;
+
+	// tjhandle of each encoder thread
+	std::vector<void*> m_handles;
+
+	std::vector<Slot> m_slots;
+	std::vector<int> m_free;
+	std::deque<int> m_queued;
+	std::vector<ThreadStats> m_stats;
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::condition_variable m_cv_idle;
+	Callback m_callback;
+	std::atomic<uint64_t> m_dropped;
+	bool m_quit;
+};
+
+/**
+ * Write a JPEG image to <dir>/color_<frame_number>.jpg. Safe to call from
+ * several encoder threads at once.
+ */
+bool save_jpeg(const std::string& dir, const unsigned char* jpeg, unsigned long size, uint64_t frame_number);
+
+#endif // HAVE_TURBOJPEG
+
+#endif // JPEGENCODER_H__
@@ -9,122 +9,301 @@
 #include <iostream>
 #include <string.h>
 #include <stdint.h>
+#include <math.h>
+#include <cstdlib>
 #include <chrono>
 #include <list>
 #include <thread>
 
-#ifdef WIN32
-#include <Windows.h>
-#else
-#include <csignal>
-#endif
-
 #include <librealsense2/rs.hpp>
 #include <librealsense2/rs_advanced_mode.hpp>
 
 // Contains a long JSON string specifying camera settings
 #include "realsensesettings.h"
 
-bool got_sigint = false;
+#include "assembler.h"
+#include "background.h"
+#include "blobs.h"
+#include "clocksync.h"
+#include "colorframe.h"
+#include "colorizer.h"
+#include "controlseq.h"
+#include "devicecache.h"
+#include "eventbuffer.h"
+#include "framechange.h"
+#include "framemeta.h"
+#include "framering.h"
+#include "heightmap.h"
+#include "imu.h"
+#include "jpegencoder.h"
+#include "metalog.h"
+#include "numa.h"
+#include "recorder.h"
+#include "recovery.h"
+#include "roicontrol.h"
+#include "sensorstreams.h"
+#include "shutdown.h"
+#include "startup.h"
+#include "workerpool.h"
+
 const int color_w = 960;
 const int color_h = 540;
 const int depth_w = 640;
 const int depth_h = 480;
+const int depth_fps = 30;
+const int color_fps = 30;
+const int worker_threads = 0; // 0: one per core
+
+// Place buffers and worker threads on the camera's NUMA node. numa_benchmark
+// prints copy throughput from each node at startup.
+const bool numa_aware = true;
+const bool numa_benchmark = false;
+
+// Back the frame buffers and rings with 2 MB pages where the system allows.
+// huge_page_benchmark compares TLB misses and copy throughput at startup.
+const bool huge_pages = true;
+const bool huge_page_benchmark = false;
+
+// Open the sensors directly instead of through rs2::pipeline. Depth is then
+// processed at depth_fps as it arrives, with the latest color frame if a new
+// one came in, and never waits for color.
+const bool independent_streams = false;
+
+// Depth and color frames at most this many ms apart are paired. Frames left
+// without a partner are processed alone when partial framesets are allowed.
+const double frameset_tolerance_ms = 16.0;
+const bool emit_partial_framesets = true;
+
+// Time allowed for stopping the pipeline and flushing stages on exit
+const int shutdown_deadline_ms = 2000;
+
+// RGB8 is converted from YUYV by the SDK. YUYV and MJPEG are kept as delivered
+// and only converted to RGB8 when needed. MJPEG requires libjpeg-turbo.
+const rs2_format color_format = RS2_FORMAT_RGB8;
+
+// Preset last applied to each camera, so restarts can skip the advanced mode
+// toggle and settings load. Empty to always prepare the cameras from scratch.
+const char* device_cache_path = "device_state.cache";
+
+// Only the first camera is streamed and prepared. With prepare_all_devices every
+// connected camera is brought to the same settings at once, e.g. to ready
+// spares; enabling advanced mode reboots each of them.
+const bool prepare_all_devices = false;
+
+// Left / right infrared streams at depth resolution. With emitter_interleave the
+// projector is switched on and off every other frame, and IR frames are sorted
+// into separate passive / active rings by their metadata.
+const bool ir_enabled = false;
+const bool emitter_interleave = false;
+const int ir_ring_slots = 4;
+
+// Gyro and accel streams of D435i / D455 units, fused into an orientation per depth frame
+const bool imu_enabled = false;
+
+// JPEG compression of the color stream, if built with libjpeg-turbo. Changed
+// color frames are saved to jpeg_archive_dir as color_<frame number>.jpg, MJPEG
+// frames as delivered. Empty to disable, the encoder is then not started.
+const char* jpeg_archive_dir = "";
+const int jpeg_quality = 85;
+const int jpeg_threads = 2;
+
+// Raw depth recording, empty to disable. Written asynchronously with io_uring
+// when built with liburing, otherwise by pwrite threads. The index journal next
+// to it can be rebuilt after a crash with --recover <path>.
+const char* record_path = "";
+const int record_slots = 16;
+
+// Per-frame metadata, region statistics and stage timings as a columnar binary
+// log for offline analysis, empty to disable. See metalog.h for the format.
+const char* metadata_log_path = "";
+
+// Pre-trigger buffer: the last event_pre_seconds of framesets are kept in memory
+// and saved together with the following event_post_seconds when triggered by
+// SIGUSR1, a "trigger" UDP datagram to event_trigger_port on localhost (0: off),
+// or the mean depth of the center region moving by event_roi_change_mm (0: off).
+// Framesets are held in event_buffer_mb of memory, the oldest ones making room
+// for new ones; compressing depth lets more of them fit.
+const bool event_buffer_enabled = false;
+const int event_pre_seconds = 2;
+const int event_post_seconds = 1;
+const int event_buffer_mb = 192;
+const bool event_compress = true;
+const int event_trigger_port = 0;
+const float event_roi_change_mm = 0.0f;
+
+// Move the auto exposure region of interest to follow the largest foreground
+// blob, back to the center 20 % x 20 % when there is none. Updates are sent at
+// most every roi_min_interval_ms and only when an edge moved by more than
+// roi_hysteresis_px.
+const bool roi_tracking = false;
+const int roi_min_interval_ms = 500;
+const int roi_hysteresis_px = 16;
+
+// Depth preview colors. The fixed range is mapped with SIMD; equalizing spreads
+// the colors over the depth present in each frame, at the cost of a histogram
+// pass per frame.
+const bool preview_equalize = false;
+const uint16_t preview_min_depth = 300;
+const uint16_t preview_max_depth = 6000;
+
+// Camera mounting for the height map: meters above the floor, downwards tilt
+const float camera_height = 1.0f;
+const float camera_pitch_deg = 15.0f;
+
+void stop(rs2::pipeline& p) {
+	p.stop();
+}
 
 /**
- * Wrapper to call delete or delete[] on dtor
+ * Hardware timestamp and host arrival time of a frame, in ms. Prefers the raw
+ * sensor counter and the backend arrival time from metadata.
  */
-template <class T>
-class DeleteLater {
-public:
-	DeleteLater(T* p, bool is_arr, std::string n) {
-		m_p = p;
-		m_arr = is_arr;
-		m_name = n;
+void frame_clock_sample(const rs2::frame& f, double& hw, double& host) {
+	if (f.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_TIMESTAMP)) {
+		hw = f.get_frame_metadata(RS2_FRAME_METADATA_FRAME_TIMESTAMP) / 1000.0;
+	} else {
+		hw = f.get_timestamp();
 	}
 
-	virtual ~DeleteLater() {
-		if (!m_p)
-			return;
+	if (f.supports_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL)) {
+		host = (double)f.get_frame_metadata(RS2_FRAME_METADATA_TIME_OF_ARRIVAL);
+	} else {
+		host = std::chrono::duration<double, std::milli>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+}
 
-		std::cout << "freeing memory: " << m_name << std::endl;
+/**
+ * Host time of a frame, mapped by the clock of its sensor. With sample, the
+ * frame is added to the clock's fit first; IR frames share the depth
+ * sensor's clock and are mapped without feeding it.
+ */
+double frame_host_time(ClockSync& clock, const rs2::frame& f, bool sample) {
+	double hw, host;
+	frame_clock_sample(f, hw, host);
 
-		if (m_arr) {
-			delete[] m_p;
-		} else {
-			delete m_p;
-		}
+	if (sample) {
+		clock.add_sample(hw, host);
 	}
 
-	T* m_p;
-	bool m_arr;
-	std::string m_name;
-};
-
-void stop(rs2::pipeline& p) {
-	p.stop();
+	return clock.to_host(hw);
 }
 
-#ifdef WIN32
-bool sigint_handler(DWORD fdwCtrlType) {
-	if(fdwCtrlType == CTRL_C_EVENT) {
-		std::cout << "signal caught: " << fdwCtrlType<< std::endl;
-		got_sigint = true;
-		return true;
+/**
+ * Mean of the valid depth values in the center 20 % x 20 % region, the same
+ * region auto exposure is restricted to. Negative if there are none.
+ */
+double roi_mean_depth(const uint16_t* depth, int w, int h) {
+	uint64_t sum = 0;
+	int n = 0;
+
+	for (int y = h * 4 / 10; y < h * 6 / 10; y++) {
+		for (int x = w * 4 / 10; x < w * 6 / 10; x++) {
+			uint16_t d = depth[y * w + x];
+			if (d) {
+				sum += d;
+				n++;
+			}
+		}
 	}
 
-	return false;
-}
-#else
-void sigint_handler(int sig)
-{
-	std::cout << "signal caught: " << sig << std::endl;
-	got_sigint = true;
+	return n ? (double)sum / n : -1.0;
 }
-#endif
 
-int main() try {
+/**
+ * Wait up to timeout_ms for a frame from q, in short steps so that shutdown
+ * requests are noticed. Frame queues have no descriptor to poll together with
+ * Shutdown::fd(), a frame arriving still ends the wait at once.
+ * Returns false on timeout or shutdown.
+ */
+bool wait_for_frame(const rs2::frame_queue& q, Shutdown& shutdown, int timeout_ms, rs2::frame& f) {
+	const int step_ms = 10;
+	int waited = 0;
 
-	// register signal handlers
-#ifdef WIN32
-	SetConsoleCtrlHandler( (PHANDLER_ROUTINE) sigint_handler, TRUE );
-#else
-	signal(SIGINT, sigint_handler);
-#endif
+	while (!shutdown.requested()) {
+		if (q.try_wait_for_frame(&f, step_ms)) {
+			return true;
+		}
 
-	// allocate buffers for reading color and depth frames
-	unsigned char* colorbuf = new unsigned char[color_w * color_h * 3];
-	if (colorbuf == NULL) {
-		std::cout << "failed allocating colorbuf" << std::endl;
-		return 1;
+		waited += step_ms;
+		if (waited >= timeout_ms) {
+			std::cout << "No frames received in " << waited << " ms" << std::endl;
+			break;
+		}
 	}
 
-	DeleteLater<unsigned char> del1(colorbuf, true, "colorbuffer");
+	return false;
+}
 
-	uint16_t* depthbuf = new uint16_t[depth_w * depth_h];
-	if (depthbuf == NULL) {
-		std::cout << "failed allocating depthbuf" << std::endl;
-		return 1;
+int main(int argc, char** argv) try {
+
+	// Rebuild the index of a recording cut short by a crash, then exit
+	if (argc == 3 && strcmp(argv[1], "--recover") == 0) {
+		return recover_recording(argv[2]) ? 0 : 1;
 	}
 
-	DeleteLater<uint16_t> del2(depthbuf, true, "depthbuffer");
+	// Time of each startup step, up to the first processed frame
+	StartupProfiler startup;
+	auto step_start = std::chrono::steady_clock::now();
 
-	memset(colorbuf, 0, color_w*color_h*3);
-	memset(depthbuf, 0, depth_w*depth_h*sizeof(uint16_t));
+	// register signal handlers
+	Shutdown shutdown;
+	shutdown.install_signal_handlers();
 
-	std::cout << "Allocated memory" << std::endl;
+	if (!ColorFrame::supported(color_format)) {
+		std::cout << "Unsupported color format: " << rs2_format_to_string(color_format) << std::endl;
+		return 1;
+	}
 
 	rs2::context context;
 
+	// Motion samples go through a lock-free ring and video framesets through a
+	// frame queue, so high rate IMU data never holds back the depth path.
+	// Declared before the pipeline, which calls into them until destroyed.
+	ImuFusion imu(4096, 1024);
+	rs2::frame_queue video_queue(2);
+
+	// Exposure, gain and emitter state of depth frames as they arrive, for
+	// confirming control commands
+	MetadataMonitor depth_meta_monitor;
+
 	// Create a Pipeline - this serves as a top-level API for streaming and processing frames
 	rs2::pipeline pipeline(context);
 	std::shared_ptr<rs2_pipeline> p_pipeline = std::shared_ptr<rs2_pipeline>(pipeline);
 
 	std::cout << "Created pipeline" << std::endl;
 
-	rs2::device_list devs = context.query_devices();
-	if (devs.size() != 1) {
-		std::cout << "Expecting to find one device connected to the computer" << std::endl;
+	step_start = std::chrono::steady_clock::now();
+	rs2::device_list devlist = context.query_devices();
+	startup.add("query_devices", step_start);
+
+	DeviceStateCache device_cache(device_cache_path);
+	bool use_cache = device_cache_path[0] != '\0';
+	if (use_cache) {
+		device_cache.load();
+	}
+
+	std::vector<rs2::device> devs;
+	if (prepare_all_devices) {
+		// In parallel, as enabling advanced mode reboots them and takes seconds each
+		for (uint32_t i = 0; i < devlist.size(); i++) {
+			devs.push_back(devlist[i]);
+		}
+		prepare_devices(context, devs, realsense_advanced_settings_json, startup, use_cache ? &device_cache : NULL);
+	} else {
+		// The first camera that can be prepared, leaving the others untouched
+		for (uint32_t i = 0; i < devlist.size() && devs.empty(); i++) {
+			devs.push_back(devlist[i]);
+			prepare_devices(context, devs, realsense_advanced_settings_json, startup, use_cache ? &device_cache : NULL);
+		}
+	}
+
+	if (use_cache) {
+		device_cache.save();
+	}
+
+	if (devs.empty()) {
+		std::cout << "Expecting to find a device connected to the computer" << std::endl;
 		return 1;
 	}
 
@@ -132,246 +311,724 @@ int main() try {
 	const char* serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
 	std::cout << "Using camera: " << serial << std::endl;
 
+	if (devlist.size() > 1) {
+		std::cout << "Streaming one of " << devlist.size() << " cameras, " << devs.size()
+			<< " prepared" << std::endl;
+	}
+
 	std::vector<rs2::sensor> sensors = dev.query_sensors();
 	std::cout << "Device has " << sensors.size() << " sensors" << std::endl;
 
-	rs400::advanced_mode adv(dev);
-	if (!adv.is_enabled()) {
-		std::cout << "advanced mode is not enabled -> enabling it" << std::endl;
+	// Frame buffers and workers go on the NUMA node of the camera's USB
+	// controller, with this thread pinned there, so frames are not copied
+	// across sockets on multi-socket hosts
+	int numa_node = -1;
+	if (numa_aware && numa_node_count() > 1 && dev.supports(RS2_CAMERA_INFO_PHYSICAL_PORT)) {
+		numa_node = numa_node_of_path(dev.get_info(RS2_CAMERA_INFO_PHYSICAL_PORT));
+	}
 
-		adv.toggle_advanced_mode(true);
-		std::cout << "Finished toggling advanced mode" << std::endl;
-	} else {
-		std::cout << "advanced mode is already enabled" << std::endl;
+	if (numa_node >= 0) {
+		std::cout << "Camera is on NUMA node " << numa_node << std::endl;
+		if (!numa_pin_current_thread(numa_node)) {
+			std::cout << "Failed pinning capture thread to NUMA node " << numa_node << std::endl;
+		}
 	}
 
-	try {
-		// This variable is in an external file due to it being a very long string
-		adv.load_json(realsense_advanced_settings_json);
-	} catch (const rs2::error& e) {
-		std::cout << "RealSense error calling " << e.get_failed_function()
-			<< "(" << e.get_failed_args() << "):\n " << e.what() <<
-			" when loading settings JSON." << std::endl;
+	if (numa_benchmark) {
+		numa_copy_benchmark(numa_node >= 0 ? numa_node : 0, depth_w * depth_h * sizeof(uint16_t) * 16);
+	}
+
+	if (huge_page_benchmark) {
+		page_size_benchmark(256 * 1024 * 1024, depth_w * depth_h * sizeof(uint16_t));
+	}
+
+	step_start = std::chrono::steady_clock::now();
+
+	// allocate buffers for reading color and depth frames, all from one slab
+	size_t colorbuf_size = color_w * color_h * 3;
+	size_t depthbuf_size = depth_w * depth_h * sizeof(uint16_t);
+	size_t previewbuf_size = depth_w * depth_h * 3;
+	size_t ir_ring_size = ir_enabled ? (size_t)depth_w * depth_h * ir_ring_slots : 0;
+
+	NumaSlab slab(colorbuf_size + depthbuf_size + previewbuf_size + ir_ring_size * 4 + 64 * 8, numa_node, huge_pages);
+	std::cout << "Frame buffers use " << slab.pages_name() << std::endl;
+
+	unsigned char* colorbuf = (unsigned char*)slab.alloc(colorbuf_size);
+	uint16_t* depthbuf = (uint16_t*)slab.alloc(depthbuf_size);
+
+	// colorized depth for previews, next to the color image
+	unsigned char* previewbuf = (unsigned char*)slab.alloc(previewbuf_size);
+
+	if (colorbuf == NULL || depthbuf == NULL || previewbuf == NULL) {
+		std::cout << "failed allocating frame buffers" << std::endl;
+		return 1;
+	}
+
+	// Latest color frame, decoded into colorbuf on demand
+	ColorFrame color(color_w, color_h, colorbuf);
+
+	memset(colorbuf, 0, color_w*color_h*3);
+	memset(depthbuf, 0, depth_w*depth_h*sizeof(uint16_t));
+	memset(previewbuf, 0, depth_w*depth_h*3);
+
+	std::cout << "Allocated memory" << std::endl;
+
+	// IR frames by sensor and emitter state: [(index - 1) * 2 + emitter on]
+	std::vector<FrameRing> ir_rings;
+	if (ir_enabled) {
+		for (int i = 0; i < 4; i++) {
+			unsigned char* storage = (unsigned char*)slab.alloc(ir_ring_size);
+			memset(storage, 0, ir_ring_size);
+			ir_rings.push_back(FrameRing(depth_w * depth_h, ir_ring_slots, storage));
+		}
+	}
+
+	// Per-tile change tracking, filled while frames are copied into the buffers
+	TileChangeMap depth_tiles(depth_w, depth_h, 32);
+	TileChangeMap color_tiles(color_w, color_h, 32);
+
+	// Foreground / motion mask over depthbuf
+	BackgroundModel background(depth_w, depth_h);
+
+	WorkerPool pool(worker_threads, numa_node);
+	BlobExtractor blobs(depth_w, depth_h, pool);
+	std::cout << "Worker pool has " << pool.size() << " threads" << std::endl;
+
+	DepthColorizer colorizer(DepthColorizer::PALETTE_TURBO);
+	colorizer.m_equalize = preview_equalize;
+	colorizer.set_range(preview_min_depth, preview_max_depth);
+
+#ifdef HAVE_TURBOJPEG
+	std::unique_ptr<JpegEncoder> jpeg;
+	if (jpeg_archive_dir[0] != '\0' && color_format != RS2_FORMAT_MJPEG) {
+		jpeg.reset(new JpegEncoder(color_w, color_h, jpeg_quality, jpeg_threads, jpeg_threads * 2));
+		if (jpeg->failed()) {
+			std::cout << "JPEG archiving disabled" << std::endl;
+			jpeg.reset();
+		} else {
+			jpeg->set_callback([](const unsigned char* data, unsigned long size, uint64_t frame_number) {
+				save_jpeg(jpeg_archive_dir, data, size, frame_number);
+			});
+		}
+	}
+#endif
+
+	std::unique_ptr<EventBuffer> events;
+	if (event_buffer_enabled) {
+		events.reset(new EventBuffer(depth_w * depth_h * sizeof(uint16_t), color_w * color_h * 3,
+			(size_t)event_buffer_mb * 1024 * 1024, event_pre_seconds * depth_fps, event_post_seconds * depth_fps,
+			event_compress));
+		EventBuffer::install_signal_trigger();
+
+		if (event_trigger_port > 0) {
+			events->listen_udp(event_trigger_port, shutdown.fd());
+		}
+	}
+
+	// Running average of the center region's depth, for the event trigger
+	double roi_depth_baseline = -1.0;
+
+	Recorder recorder(depth_w * depth_h * sizeof(uint16_t), record_slots);
+	if (record_path[0] != '\0' && !recorder.open(record_path)) {
+		return 1;
+	}
+
+	MetadataLog metalog;
+	const int col_frame = metalog.add_column("frame_number", MetadataLog::TYPE_U64);
+	const int col_hw_time = metalog.add_column("hw_timestamp_ms", MetadataLog::TYPE_F64);
+	const int col_host_time = metalog.add_column("host_time_ms", MetadataLog::TYPE_F64);
+	const int col_color_host_time = metalog.add_column("color_host_time_ms", MetadataLog::TYPE_F64);
+	const int col_exposure = metalog.add_column("exposure_us", MetadataLog::TYPE_F32);
+	const int col_gain = metalog.add_column("gain", MetadataLog::TYPE_F32);
+	const int col_laser = metalog.add_column("laser_power", MetadataLog::TYPE_F32);
+	const int col_emitter = metalog.add_column("emitter", MetadataLog::TYPE_I32);
+	const int col_auto_exposure = metalog.add_column("auto_exposure", MetadataLog::TYPE_I32);
+	const int col_roi_depth = metalog.add_column("roi_mean_depth_mm", MetadataLog::TYPE_F32);
+	const int col_foreground = metalog.add_column("foreground_pixels", MetadataLog::TYPE_I32);
+	const int col_depth_tiles = metalog.add_column("changed_depth_tiles", MetadataLog::TYPE_I32);
+	const int col_color_tiles = metalog.add_column("changed_color_tiles", MetadataLog::TYPE_I32);
+	const int col_blobs = metalog.add_column("blobs", MetadataLog::TYPE_I32);
+	const int col_wait = metalog.add_column("wait_ms", MetadataLog::TYPE_F32);
+	const int col_stages = metalog.add_column("stages_ms", MetadataLog::TYPE_F32);
+	const int col_frame_time = metalog.add_column("frame_ms", MetadataLog::TYPE_F32);
+
+	if (metadata_log_path[0] != '\0' && !metalog.open(metadata_log_path)) {
+		return 1;
 	}
 
+	startup.add("buffers and workers", step_start);
+
 	// Enable max resolution streams
 	rs2::config conf;
 
 	conf.enable_device(serial);
-	conf.enable_stream(RS2_STREAM_DEPTH, -1, depth_w, depth_h, RS2_FORMAT_Z16, 30);
-	conf.enable_stream(RS2_STREAM_COLOR, -1, color_w, color_h, RS2_FORMAT_RGB8, 30);
+	conf.enable_stream(RS2_STREAM_DEPTH, -1, depth_w, depth_h, RS2_FORMAT_Z16, depth_fps);
+	conf.enable_stream(RS2_STREAM_COLOR, -1, color_w, color_h, color_format, color_fps);
+
+	if (ir_enabled) {
+		conf.enable_stream(RS2_STREAM_INFRARED, 1, depth_w, depth_h, RS2_FORMAT_Y8, depth_fps);
+		conf.enable_stream(RS2_STREAM_INFRARED, 2, depth_w, depth_h, RS2_FORMAT_Y8, depth_fps);
+	}
+
+	if (imu_enabled) {
+		conf.enable_stream(RS2_STREAM_GYRO, RS2_FORMAT_MOTION_XYZ32F);
+		conf.enable_stream(RS2_STREAM_ACCEL, RS2_FORMAT_MOTION_XYZ32F);
+	}
 
 	std::cout << "streams enabled" << std::endl;
 
 	uint64_t frames_got = 0;
 
-	// Configure and start the pipeline
-	rs2::pipeline_profile prof = pipeline.start(conf);
-	std::cout << "pipeline started" << std::endl;
-
-	// As per https://github.com/IntelRealSense/librealsense/issues/9157
-	// controlling some depth / color sensor settings is not possible with RSUSB backend
-	// without retrieving new pointers after starting the pipeline
-	auto dev2 = prof.get_device();
+	SensorStreams streams(dev, 2);
+	streams.set_depth_observer([&](const rs2::frame& f) { depth_meta_monitor.observe(f); });
 	std::unique_ptr<rs2::depth_sensor> depthSensor;
+	rs2::video_stream_profile depth_profile;
+
+	step_start = std::chrono::steady_clock::now();
+
+	if (independent_streams) {
+		if (!streams.add_depth(depth_w, depth_h, depth_fps, ir_enabled) ||
+			!streams.add_color(color_w, color_h, color_format, color_fps) ||
+			(imu_enabled && !streams.add_motion([&](rs2::frame f) { imu.push(f.as<rs2::motion_frame>()); }))) {
+			return 1;
+		}
 
-	depthSensor.reset(new rs2::depth_sensor(dev2.first<rs2::depth_sensor>()));
+		streams.start();
+		std::cout << "sensors started" << std::endl;
+
+		depthSensor.reset(new rs2::depth_sensor(dev.first<rs2::depth_sensor>()));
+		depth_profile = streams.depth_profile();
+	} else {
+		// Configure and start the pipeline
+		rs2::pipeline_profile prof = pipeline.start(conf, [&](rs2::frame f) {
+			if (f.is<rs2::motion_frame>()) {
+				imu.push(f.as<rs2::motion_frame>());
+			} else {
+				depth_meta_monitor.observe(f);
+				video_queue.enqueue(f);
+			}
+		});
+		std::cout << "pipeline started" << std::endl;
+
+		// As per https://github.com/IntelRealSense/librealsense/issues/9157
+		// controlling some depth / color sensor settings is not possible with RSUSB backend
+		// without retrieving new pointers after starting the pipeline
+		auto dev2 = prof.get_device();
+		depthSensor.reset(new rs2::depth_sensor(dev2.first<rs2::depth_sensor>()));
+		depth_profile = prof.get_stream(RS2_STREAM_DEPTH).as<rs2::video_stream_profile>();
+	}
+
+	startup.add(independent_streams ? "sensor start" : "pipeline start", step_start);
+	step_start = std::chrono::steady_clock::now();
+	bool first_frame = true;
+
+	auto stop_streams = [&]() {
+		if (independent_streams) {
+			streams.stop();
+		} else {
+			stop(pipeline);
+		}
+	};
+
+	if (emitter_interleave) {
+		try {
+			if (depthSensor->supports(RS2_OPTION_EMITTER_ON_OFF)) {
+				depthSensor->set_option(RS2_OPTION_EMITTER_ON_OFF, 1.0f);
+				std::cout << "emitter on / off interleaving enabled" << std::endl;
+			} else {
+				std::cout << "depth sensor does not support emitter on / off interleaving" << std::endl;
+			}
+		} catch (const rs2::error& e) {
+			std::cout << "RealSense error calling " << e.get_failed_function()
+				<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+				" when enabling emitter interleaving." << std::endl;
+		}
+	}
+
+	// 8 x 8 meter height map in front of the camera, 5 cm cells
+	rs2_intrinsics depth_intr = depth_profile.get_intrinsics();
+	float depth_scale = depthSensor->get_depth_scale();
+	HeightMap heightmap(depth_intr, depth_scale, pool, 0.05f, 160, 160, 0.0f, -4.0f);
+	heightmap.set_mount(camera_height, camera_pitch_deg * 3.14159265f / 180.0f);
+
+	rs2::region_of_interest center_roi;
+	center_roi.min_x = depth_w*0.4f;
+	center_roi.max_x = depth_w*0.6f;
+	center_roi.min_y = depth_h*0.4f;
+	center_roi.max_y = depth_h*0.6f;
+
+	RoiController roi_control(depth_w, depth_h, center_roi);
+	roi_control.m_min_interval_ms = roi_min_interval_ms;
+	roi_control.m_hysteresis = roi_hysteresis_px;
+
+	bool roi_supported = false;
+	try {
+		roi_supported = depthSensor->is<rs2::roi_sensor>();
+	} catch (const rs2::error& e) {
+		std::cout << "RealSense error calling " << e.get_failed_function()
+			<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+			" when testing if sensor supports a region of interest." << std::endl;
+	}
+
+	if (roi_tracking && !roi_supported) {
+		std::cout << "depth sensor has no auto exposure region of interest, not tracking" << std::endl;
+	}
 
 	std::cout << "entering main loop" << std::endl;
 
+	bool warned_ir_metadata = false;
+
+	// Hardware timestamps to host time per sensor, 10 second windows
+	ClockSync depth_clock(300);
+	ClockSync color_clock(color_fps * 10);
+
+	// IR frames are filed right away, by sensor and emitter state
+	auto file_ir_frame = [&](const rs2::frame& f) {
+		rs2::video_frame irframe = f.as<rs2::video_frame>();
+		int index = f.get_profile().stream_index();
+
+		if (irframe.get_width() != depth_w || irframe.get_height() != depth_h || index < 1 || index > 2) {
+			return;
+		}
+
+		// The projector state the frame was exposed with. Without metadata
+		// support in the kernel / backend everything is filed as active.
+		bool emitter_on = true;
+		if (f.supports_frame_metadata(RS2_FRAME_METADATA_FRAME_LASER_POWER_MODE)) {
+			emitter_on = f.get_frame_metadata(RS2_FRAME_METADATA_FRAME_LASER_POWER_MODE) != 0;
+		} else if (emitter_interleave && !warned_ir_metadata) {
+			std::cout << "IR frames carry no emitter metadata, cannot split passive / active frames" << std::endl;
+			warned_ir_metadata = true;
+		}
+
+		ir_rings[(index - 1) * 2 + (emitter_on ? 1 : 0)].push(irframe.get_data(),
+			depth_w * depth_h, f.get_frame_number(), frame_host_time(depth_clock, f, false));
+	};
+
+	// Time from frame arrival on the host to processing, for comparing stream modes
+	double depth_latency_sum = 0.0;
+	int depth_latency_frames = 0;
+
+	FramesetAssembler assembler(emit_partial_framesets ? FramesetAssembler::EMIT_PARTIAL : FramesetAssembler::EMIT_COMPLETE,
+		frameset_tolerance_ms, 200.0);
+
 	std::list<int> ftimes;
 	int dur_sum = 0;
 
 	std::chrono::high_resolution_clock::time_point t_since_toggle = std::chrono::high_resolution_clock::now();
 	int64_t next_toggle = 3000;
 
+	// Camera control sequences, advanced from this thread every frame
+	ControlScheduler control;
+
 	while (true) {
 
 		std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
 
-		if (got_sigint) {
+		if (shutdown.requested()) {
 			break;
 		}
 
-		// Block program until frames arrive
-		rs2::frameset frames = pipeline.wait_for_frames(3000);
+		FramesetAssembler::Set set;
+
+		if (independent_streams) {
+			// Depth at its own rate, plus the newest color frame if one arrived
+			rs2::frame f;
+			do {
+				if (!wait_for_frame(streams.depth_queue(), shutdown, 3000, f)) {
+					break;
+				}
+
+				if (f.get_profile().stream_type() == RS2_STREAM_INFRARED) {
+					file_ir_frame(f);
+					f = rs2::frame();
+				}
+			} while (!f);
+
+			if (!f) {
+				break;
+			}
+
+			set.depth = f;
+			set.depth_host_time = frame_host_time(depth_clock, f, true);
+			set.color_host_time = 0.0;
+			set.timestamp = set.depth_host_time;
+
+			rs2::frame c;
+			while (streams.color_queue().poll_for_frame(&c)) {
+				set.color = c;
+				set.color_host_time = frame_host_time(color_clock, c, true);
+			}
+		} else if (!assembler.pop(set)) {
+			rs2::frame fs;
+			if (!wait_for_frame(video_queue, shutdown, 3000, fs)) {
+				break;
+			}
+
+			rs2::frameset frames(fs);
+
+			// depth and color go through the assembler
+			for (auto&& f : frames) {
+				rs2_stream type = f.get_profile().stream_type();
+				if (type == RS2_STREAM_INFRARED) {
+					file_ir_frame(f);
+				} else {
+					assembler.push(f, frame_host_time(type == RS2_STREAM_COLOR ? color_clock : depth_clock, f, true));
+				}
+			}
+
+			if (!assembler.pop(set)) {
+				continue;
+			}
+		}
+
+		std::chrono::high_resolution_clock::time_point t_set = std::chrono::high_resolution_clock::now();
 
 		bool got_depth = false;
+		FrameMetadata depth_meta;
+		double depth_timestamp = 0.0;
+		double depth_host_time = set.depth_host_time;
+		double color_host_time = set.color_host_time;
 		bool got_color = false;
 
-		// get specific frame instances
-		for (auto&& f : frames) {
-			if (f.is<rs2::depth_frame>()) {
-				rs2::depth_frame dframe = f.as<rs2::depth_frame>();
-				int d_width = dframe.get_width();
-				int d_height = dframe.get_height();
+		if (set.depth) {
+			rs2::depth_frame dframe = set.depth.as<rs2::depth_frame>();
+			int d_width = dframe.get_width();
+			int d_height = dframe.get_height();
 
-				if (d_width != depth_w || d_height != depth_h) {
+			if (d_width != depth_w || d_height != depth_h) {
 
-					std::cout << "Invalid depth frame resolution: "
-						<< d_width << ", " << d_height << std::endl;
+				std::cout << "Invalid depth frame resolution: "
+					<< d_width << ", " << d_height << std::endl;
 
-					stop(pipeline);
-					return 1;
-				}
+				stop_streams();
+				return 1;
+			}
 
-				uint16_t* depthdata = (uint16_t*)dframe.get_data();
-				memcpy(depthbuf, depthdata, depth_w * depth_h * sizeof(uint16_t));
-				got_depth = true;
+			depth_timestamp = dframe.get_timestamp();
+			depth_meta = FrameMetadata::read(dframe);
 
-			} else if (f.is<rs2::video_frame>()) {
-				rs2::video_frame cframe = f.as<rs2::video_frame>();
-				int c_width = cframe.get_width();
-				int c_height = cframe.get_height();
+			double hw, host;
+			frame_clock_sample(dframe, hw, host);
 
-				if (c_width != color_w || c_height != color_h) {
-					std::cout << "Invalid color frame resolution: "
-						<< c_width << ", " << c_height << std::endl;
-					stop(pipeline);
-					return 1;
-				}
+			depth_latency_sum += std::chrono::duration<double, std::milli>(
+				std::chrono::system_clock::now().time_since_epoch()).count() - host;
+			depth_latency_frames++;
+
+			uint16_t* depthdata = (uint16_t*)dframe.get_data();
+			copy_depth_tracked(depthbuf, depthdata, depth_tiles);
+			got_depth = true;
 
-				unsigned char* colordata = (unsigned char*)cframe.get_data();
-				memcpy(colorbuf, colordata, color_w * color_h * 3);
-				got_color = true;
+			if (recorder.is_open()) {
+				recorder.submit(depthdata, d_width * d_height * sizeof(uint16_t),
+					dframe.get_frame_number(), depth_host_time);
 			}
 		}
 
-		if (!got_color || !got_depth) {
-			std::cout << "Did not get all frame types" << std::endl;
-			break;
+		if (set.color) {
+			rs2::video_frame cframe = set.color.as<rs2::video_frame>();
+			int c_width = cframe.get_width();
+			int c_height = cframe.get_height();
+
+			if (c_width != color_w || c_height != color_h) {
+				std::cout << "Invalid color frame resolution: "
+					<< c_width << ", " << c_height << std::endl;
+				stop_streams();
+				return 1;
+			}
+
+			if (!color.store(cframe.get_data(), cframe.get_data_size(), color_format, &color_tiles)) {
+				std::cout << "Invalid color frame: " << cframe.get_data_size() << " bytes" << std::endl;
+				stop_streams();
+				return 1;
+			}
+
+			got_color = true;
+		}
+
+		// Without the assembler depth arriving alone is the normal case
+		if ((!got_color || !got_depth) && !independent_streams) {
+			std::cout << "Partial frameset: " << (got_depth ? "depth" : "color") << " only" << std::endl;
 		}
 
 		frames_got++;
 
-		std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
-		auto toggle = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t_since_toggle).count();
+		if (first_frame) {
+			startup.add("first frame", step_start);
+			startup.print();
+			first_frame = false;
+		}
 
-		if (toggle > next_toggle) {
+		if (events && got_depth) {
+			events->poll_signal_trigger();
 
-			// Disable auto exposure, re-enable it, specify region of interest
-			t_since_toggle = t2;
-			next_toggle = next_toggle + 10000;
+			if (event_roi_change_mm > 0.0f) {
+				double roi_depth = roi_mean_depth(depthbuf, depth_w, depth_h);
+				if (roi_depth >= 0.0) {
+					if (roi_depth_baseline < 0.0) {
+						roi_depth_baseline = roi_depth;
+					}
 
-			try {
-				if (!depthSensor->supports(RS2_OPTION_ENABLE_AUTO_EXPOSURE) ||
-					!depthSensor->supports(RS2_OPTION_EMITTER_ENABLED) ||
-					!depthSensor->is<rs2::roi_sensor>()) {
-					continue;
+					float change_mm = (float)fabs(roi_depth - roi_depth_baseline) * depth_scale * 1000.0f;
+					if (change_mm > event_roi_change_mm) {
+						events->trigger("region depth change");
+					}
+
+					roi_depth_baseline += (roi_depth - roi_depth_baseline) * 0.05;
 				}
-			} catch (const rs2::error& e) {
-				std::cout << "RealSense error calling " << e.get_failed_function()
-					<< "(" << e.get_failed_args() << "):\n " << e.what() <<
-					" when testing if sensor is depth sensor." << std::endl;
-				continue;
 			}
 
-			int tries = 0;
-			bool success = false;
+			const unsigned char* cdata = got_color ? (const unsigned char*)set.color.get_data() : NULL;
+			size_t csize = got_color ? set.color.get_data_size() : 0;
+			events->push(depthbuf, depth_w * depth_h * sizeof(uint16_t), cdata, csize,
+				set.depth.get_frame_number(), depth_host_time);
+		}
 
-			while (tries < 10 && success == false) {
+		// orientation of the camera when the depth frame was exposed
+		Quat depth_orientation = { 1.0f, 0.0f, 0.0f, 0.0f };
+		bool have_orientation = false;
+		if (imu_enabled && got_depth) {
+			imu.update();
+			have_orientation = imu.orientation_at(depth_timestamp, depth_orientation);
+		}
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(33));
-				tries++;
+		// Static scenes leave every depth tile untouched, skip the stages. The
+		// background model still runs, as it does a full pass every few frames.
+		bool scene_changed = false;
+		std::chrono::high_resolution_clock::time_point t_stages = std::chrono::high_resolution_clock::now();
+		if (got_depth) {
+			scene_changed = background.update(depthbuf, &depth_tiles);
 
-				try {
-					std::cout << "Getting auto exposure state (1)" << std::endl;
-					float aexp = depthSensor->get_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE);
+			if (depth_tiles.any_changed() || background.flipped_pixels() > 0) {
+				blobs.extract(background.mask(), depthbuf);
+			}
 
-					if (aexp != 0.f) {
-						std::cout << "Setting auto exposure off" << std::endl;
-						depthSensor->set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 0.0f);
-						std::cout << "successfully disabled auto exposure" << std::endl;
-						std::this_thread::sleep_for(std::chrono::seconds(3));
-					} else {
-						std::cout << "Auto exposure is already off, no need to disable: " << aexp << std::endl;
-					}
-					success = true;
-				} catch (const rs2::error& e) {
-					std::cout << "RealSense error calling " << e.get_failed_function()
-						<< "(" << e.get_failed_args() << "):\n " << e.what() <<
-						" when disabling auto exposure." << std::endl;
+			if (depth_tiles.any_changed()) {
+				heightmap.update(depthbuf);
+				colorizer.colorize(depthbuf, depth_w * depth_h, previewbuf);
+			}
+		}
+		std::chrono::high_resolution_clock::time_point t_stages_done = std::chrono::high_resolution_clock::now();
+
+		if (roi_tracking && got_depth) {
+			roi_control.update(blobs.blobs());
+		}
+
+#ifdef HAVE_TURBOJPEG
+		if (got_color && jpeg_archive_dir[0] != '\0' && color_tiles.any_changed()) {
+			if (color_format == RS2_FORMAT_MJPEG) {
+				// MJPEG frames are JPEG already
+				save_jpeg(jpeg_archive_dir, (const unsigned char*)set.color.get_data(), set.color.get_data_size(),
+					set.color.get_frame_number());
+			} else {
+				const unsigned char* rgb = color.rgb();
+				if (rgb) {
+					jpeg->submit(rgb, set.color.get_frame_number());
 				}
 			}
+		}
 
-			tries = 0;
-			success = false;
+		if (jpeg && frames_got % 100 == 0) {
+			jpeg->print_stats();
+		}
+#endif
 
-			while (tries < 10 && success == false) {
+		if (frames_got % 100 == 0) {
+			color.print_stats();
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(33));
-				tries++;
+			if (recorder.is_open()) {
+				recorder.print_stats();
+			}
 
-				try {
-					std::cout << "Setting auto exposure on" << std::endl;
-					depthSensor->set_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1.0f);
-					std::cout << "success setting auto exposure on" << std::endl;
-					success = true;
-					std::this_thread::sleep_for(std::chrono::seconds(3));
-				} catch (const rs2::error& e) {
-					std::cout << "RealSense error calling " << e.get_failed_function()
-						<< "(" << e.get_failed_args() << "):\n " << e.what() <<
-						" when toggling device auto exposure settings." << std::endl;
-				}
+			if (metalog.is_open()) {
+				std::cout << "metadata log: " << metalog.rows() << " rows" << std::endl;
 			}
 
-			tries = 0;
-			success = false;
+			if (events) {
+				events->print_stats();
+			}
 
-			while (tries < 10 && success == false) {
+			double now = std::chrono::duration<double, std::milli>(
+				std::chrono::system_clock::now().time_since_epoch()).count();
+			std::cout << "depth frame host time " << (int64_t)depth_host_time << " ms, " << now - depth_host_time
+				<< " ms ago, clock drift " << depth_clock.drift_ppm() << " ppm, fit residual "
+				<< depth_clock.residual() << " ms" << std::endl;
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(33));
-				tries++;
+			if (got_color) {
+				std::cout << "color frame host time " << (int64_t)color_host_time << " ms, " << now - color_host_time
+					<< " ms ago, clock drift " << color_clock.drift_ppm() << " ppm, fit residual "
+					<< color_clock.residual() << " ms" << std::endl;
+			}
 
-				try {
-					std::cout << "Getting auto exposure state (2)" << std::endl;
-					float aexp = depthSensor->get_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE);
-					std::cout << "auto exposure value before ROI request: " << aexp << std::endl;
-					if (aexp == 0.0f) {
-						std::cout << "Cannot set ROI: auto exposure failed to re-enable" << std::endl;
-						continue;
-					}
+			if (depth_latency_frames) {
+				std::cout << "depth latency from arrival to processing: "
+					<< depth_latency_sum / depth_latency_frames << " ms" << std::endl;
+				depth_latency_sum = 0.0;
+				depth_latency_frames = 0;
+			}
 
-					rs2::region_of_interest ri;
-					ri.min_x = depth_w*0.4f;
-					ri.max_x = depth_w*0.6f;
-					ri.min_y = depth_h*0.4f;
-					ri.max_y = depth_h*0.6f;
-
-					std::cout << "Set region of interest" << std::endl;
-					depthSensor->as<rs2::roi_sensor>().set_region_of_interest(ri);
-					success = true;
-					std::cout << "success setting region of interest" << std::endl;
-					std::this_thread::sleep_for(std::chrono::seconds(1));
-				} catch (const rs2::error& e) {
-					std::cout << "RealSense error calling " << e.get_failed_function()
-						<< "(" << e.get_failed_args() << "):\n " << e.what() <<
-						" when setting auto exposure region of interest." << std::endl;
-				}
+			if (got_depth) {
+				std::cout << "depth exposure " << depth_meta.exposure << " us, gain " << depth_meta.gain
+					<< ", laser power " << depth_meta.laser_power << ", emitter " << depth_meta.emitter
+					<< ", auto exposure " << depth_meta.auto_exposure << std::endl;
 			}
 
-			tries = 0;
-			success = false;
+			std::cout << "framesets: " << assembler.complete() << " complete, " << assembler.partial()
+				<< " partial, " << assembler.misses() << " pairing misses" << std::endl;
 
-			while (tries < 10 && success == false) {
+			if (roi_tracking) {
+				std::cout << "ROI tracking: " << roi_control.sent_count() << " updates sent, "
+					<< roi_control.suppressed() << " held back by the rate limit" << std::endl;
+			}
 
-				std::this_thread::sleep_for(std::chrono::milliseconds(33));
-				tries++;
+			if (imu.dropped()) {
+				std::cout << "IMU samples dropped: " << imu.dropped() << std::endl;
+			}
 
-				try {
-					std::cout << "Enabling emitter" << std::endl;
-					depthSensor->set_option(RS2_OPTION_EMITTER_ENABLED, 1.0f);
-					success = true;
-					std::cout << "success enabling emitter" << std::endl;
-					std::this_thread::sleep_for(std::chrono::seconds(1));
-				} catch (const rs2::error& e) {
-					std::cout << "RealSense error calling " << e.get_failed_function()
-						<< "(" << e.get_failed_args() << "):\n " << e.what() <<
-					" when enabling emitter." << std::endl;
+			if (ir_enabled) {
+				std::cout << "IR frames, left passive / active: " << ir_rings[0].pushed() << " / " << ir_rings[1].pushed()
+					<< ", right passive / active: " << ir_rings[2].pushed() << " / " << ir_rings[3].pushed() << std::endl;
+			}
+		}
+
+		std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+
+		if (metalog.is_open()) {
+			// The raw sensor counter the host time was mapped from
+			double hw_time, arrival;
+			frame_clock_sample(got_depth ? set.depth : set.color, hw_time, arrival);
+
+			metalog.set_u64(col_frame, got_depth ? set.depth.get_frame_number() : set.color.get_frame_number());
+			metalog.set_f64(col_hw_time, hw_time);
+			metalog.set_f64(col_host_time, set.timestamp);
+			if (got_color) {
+				metalog.set_f64(col_color_host_time, color_host_time);
+			}
+
+			if (got_depth) {
+				double roi_depth = roi_mean_depth(depthbuf, depth_w, depth_h);
+
+				metalog.set_f32(col_exposure, depth_meta.exposure);
+				metalog.set_f32(col_gain, depth_meta.gain);
+				metalog.set_f32(col_laser, depth_meta.laser_power);
+				metalog.set_i32(col_emitter, depth_meta.emitter);
+				metalog.set_i32(col_auto_exposure, depth_meta.auto_exposure);
+				if (roi_depth >= 0.0) {
+					metalog.set_f32(col_roi_depth, (float)(roi_depth * depth_scale * 1000.0));
 				}
 			}
+
+			metalog.set_i32(col_foreground, background.foreground_pixels());
+			metalog.set_i32(col_depth_tiles, got_depth ? depth_tiles.changed_tiles() : 0);
+			metalog.set_i32(col_color_tiles, got_color ? color_tiles.changed_tiles() : 0);
+			metalog.set_i32(col_blobs, (int32_t)blobs.blobs().size());
+			metalog.set_f32(col_wait, std::chrono::duration<float, std::milli>(t_set - t1).count());
+			metalog.set_f32(col_stages, std::chrono::duration<float, std::milli>(t_stages_done - t_stages).count());
+			metalog.set_f32(col_frame_time, std::chrono::duration<float, std::milli>(t2 - t1).count());
+			metalog.end_row();
+		}
+
+		// Control sequences run a step at a time between frames, without blocking the loop
+		control.poll();
+
+		rs2::region_of_interest tracked_roi;
+		if (roi_tracking && roi_supported && control.active() == 0 &&
+			roi_control.take(std::chrono::steady_clock::now(), tracked_roi)) {
+			ControlSequence seq("roi tracking", &depth_meta_monitor);
+			RoiController* rc = &roi_control;
+			seq.set_roi(depthSensor->as<rs2::roi_sensor>(), tracked_roi, 3)
+				// Only reached if the camera took the region
+				.then([rc, tracked_roi](ControlSequence::Context&) {
+					rc->confirm_sent(tracked_roi);
+					return ControlSequence::STEP_DONE;
+				})
+				.await("region of interest", MetadataMonitor::any_frame(), 1000);
+			control.add(seq);
 		}
 
+		auto toggle = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t_since_toggle).count();
+
+		if (toggle > next_toggle && control.active() == 0) {
+
+			// Disable auto exposure, re-enable it, specify region of interest
+			t_since_toggle = t2;
+			next_toggle = next_toggle + 10000;
+
+			bool supported = false;
+			try {
+				supported = depthSensor->supports(RS2_OPTION_ENABLE_AUTO_EXPOSURE) &&
+					depthSensor->supports(RS2_OPTION_EMITTER_ENABLED) &&
+					depthSensor->is<rs2::roi_sensor>();
+			} catch (const rs2::error& e) {
+				std::cout << "RealSense error calling " << e.get_failed_function()
+					<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+					" when testing if sensor is depth sensor." << std::endl;
+			}
+
+			if (supported) {
+				// With tracking, keep the region it last sent
+				rs2::region_of_interest ri = roi_tracking ? roi_control.sent() : center_roi;
+
+				rs2::depth_sensor sensor = *depthSensor;
+
+				ControlSequence seq("exposure toggle", &depth_meta_monitor);
+				seq.then([sensor](ControlSequence::Context& ctx) -> ControlSequence::Status {
+						float aexp = 1.0f;
+						try {
+							aexp = sensor.get_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE);
+						} catch (const rs2::error& e) {
+							std::cout << "RealSense error calling " << e.get_failed_function()
+								<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+								" when getting auto exposure state." << std::endl;
+						}
+
+						if (aexp == 0.0f) {
+							// Skip disabling it and waiting for it to turn off
+							std::cout << "Auto exposure is already off, no need to disable: " << aexp << std::endl;
+							ctx.skip = 2;
+						}
+						return ControlSequence::STEP_DONE;
+					})
+					.set_option(sensor, RS2_OPTION_ENABLE_AUTO_EXPOSURE, 0.0f)
+					.await("auto exposure off", MetadataMonitor::auto_exposure_is(false), 3000)
+					.set_option(sensor, RS2_OPTION_ENABLE_AUTO_EXPOSURE, 1.0f)
+					.await("auto exposure on", MetadataMonitor::auto_exposure_is(true), 3000)
+					.then([sensor](ControlSequence::Context& ctx) -> ControlSequence::Status {
+						if (ctx.now < ctx.wake) {
+							return ControlSequence::STEP_WAIT;
+						}
+
+						// The ROI is only accepted with auto exposure on
+						float aexp = 0.0f;
+						try {
+							aexp = sensor.get_option(RS2_OPTION_ENABLE_AUTO_EXPOSURE);
+						} catch (const rs2::error& e) {
+							std::cout << "RealSense error calling " << e.get_failed_function()
+								<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+								" when getting auto exposure state." << std::endl;
+						}
+
+						if (aexp != 0.0f) {
+							return ControlSequence::STEP_DONE;
+						}
+
+						std::cout << "Cannot set ROI: auto exposure failed to re-enable" << std::endl;
+						if (++ctx.attempts >= 10) {
+							return ControlSequence::STEP_FAILED;
+						}
+
+						ctx.wake = ctx.now + std::chrono::milliseconds(33);
+						return ControlSequence::STEP_WAIT;
+					})
+					.set_roi(sensor.as<rs2::roi_sensor>(), ri)
+					// The ROI is not in frame metadata, settle for the next frame
+					.await("region of interest", MetadataMonitor::any_frame(), 1000)
+					.set_option(sensor, RS2_OPTION_EMITTER_ENABLED, 1.0f)
+					.await("emitter on", MetadataMonitor::emitter_is(true), 1000);
+
+				control.add(seq);
+			}
+		}
 		// calculate frame time
 		auto dur_frame = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
 		if (dur_frame == 0) {
@@ -396,12 +1053,69 @@ int main() try {
 		int avg_fps = 1000 / avg_dur;
 
 		std::cout << "Finished frame " << frames_got << " in " << dur_frame
-			<< " milliseconds (" << avg_fps << " fps)" << std::endl;
+			<< " milliseconds (" << avg_fps << " fps), foreground pixels: "
+			<< background.foreground_pixels() << ", changed tiles: " << depth_tiles.changed_tiles()
+			<< "/" << color_tiles.changed_tiles() << ", blobs: " << blobs.blobs().size()
+			<< ", occupied cells: " << heightmap.occupied_cells()
+			<< (scene_changed ? ", scene changed" : "") << std::endl;
+
+		if (have_orientation) {
+			std::cout << "Orientation: " << depth_orientation.w << ", " << depth_orientation.x << ", "
+				<< depth_orientation.y << ", " << depth_orientation.z << std::endl;
+		}
+
+		if (!blobs.blobs().empty()) {
+			const Blob& b = blobs.blobs()[0];
+			std::cout << "Largest blob: " << b.min_x << "," << b.min_y << " - " << b.max_x << "," << b.max_y
+				<< ", " << b.pixels << " pixels, mean depth " << b.mean_depth << std::endl;
+		}
 	}
 
 	std::cout << "exited main loop" << std::endl;
 
-	stop(pipeline);
+	// Stop everything in parallel, bounded by shutdown_deadline_ms
+	shutdown.add("pipeline", [&]() {
+		if (independent_streams) {
+			streams.stop();
+			return;
+		}
+
+		stop(pipeline);
+
+		// release queued frames back to librealsense
+		rs2::frame f;
+		while (video_queue.poll_for_frame(&f)) {
+		}
+	});
+
+#ifdef HAVE_TURBOJPEG
+	if (jpeg) {
+		shutdown.add("jpeg encoder", [&]() {
+			jpeg->flush();
+		});
+	}
+#endif
+
+	shutdown.add("recorder", [&]() {
+		recorder.close();
+	});
+
+	if (events) {
+		shutdown.add("event buffer", [&]() {
+			events->stop();
+		});
+	}
+
+	shutdown.add("metadata log", [&]() {
+		metalog.close();
+	});
+
+	if (!shutdown.run(shutdown_deadline_ms)) {
+		std::cout << "shutdown deadline exceeded, exiting" << std::endl;
+		std::cout.flush();
+		std::_Exit(1);
+	}
+
 	std::cout << "pipeline stopped" << std::endl;
 
 	return 0;
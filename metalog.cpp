@@ -0,0 +1,196 @@
+#include "metalog.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+
+static const uint32_t FILE_VERSION = 1;
+
+MetadataLog::MetadataLog(int block_rows)
+	: m_block_rows(block_rows)
+{
+	m_row_size = 0;
+	m_file = NULL;
+	m_current.rows = 0;
+	m_rows = 0;
+	m_quit = false;
+}
+
+MetadataLog::~MetadataLog() {
+	close();
+}
+
+int MetadataLog::add_column(const char* name, Type type) {
+	static const size_t sizes[] = { 8, 4, 4, 8 };
+
+	Column c;
+	c.name = name;
+	c.type = type;
+	c.size = sizes[type];
+	m_columns.push_back(c);
+	m_row_size += c.size;
+	return (int)m_columns.size() - 1;
+}
+
+bool MetadataLog::open(const std::string& path) {
+	close();
+
+	m_file = fopen(path.c_str(), "wb");
+	if (m_file == NULL) {
+		std::cout << "Failed opening metadata log " << path << std::endl;
+		return false;
+	}
+
+	// Larger stdio buffer, blocks are written in one go anyway
+	setvbuf(m_file, NULL, _IOFBF, 1 << 20);
+
+	uint32_t header[3];
+	memcpy(&header[0], "RSML", 4);
+	header[1] = FILE_VERSION;
+	header[2] = (uint32_t)m_columns.size();
+	fwrite(header, sizeof(header), 1, m_file);
+
+	m_column_offset.clear();
+	size_t offset = 0;
+	for (size_t i = 0; i < m_columns.size(); i++) {
+		unsigned char desc[2] = { (unsigned char)m_columns[i].type, (unsigned char)m_columns[i].name.size() };
+		fwrite(desc, sizeof(desc), 1, m_file);
+		fwrite(m_columns[i].name.data(), m_columns[i].name.size(), 1, m_file);
+
+		m_column_offset.push_back(offset);
+		offset += m_columns[i].size * m_block_rows;
+	}
+
+	m_current.data.resize(m_row_size * m_block_rows);
+	m_current.rows = 0;
+	m_rows = 0;
+	m_quit = false;
+	clear_row();
+
+	m_writer = std::thread(&MetadataLog::writer_main, this);
+	return true;
+}
+
+void MetadataLog::close() {
+	if (m_file == NULL) {
+		return;
+	}
+
+	if (m_current.rows > 0) {
+		queue_block();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+	m_cv.notify_all();
+	m_writer.join();
+
+	fclose(m_file);
+	m_file = NULL;
+}
+
+void MetadataLog::set(int col, const void* v, size_t size) {
+	if (m_file == NULL || col < 0 || col >= (int)m_columns.size() || size != m_columns[col].size) {
+		return;
+	}
+
+	memcpy(m_current.data.data() + m_column_offset[col] + m_current.rows * size, v, size);
+}
+
+/**
+ * Default values for the row about to be filled
+ */
+void MetadataLog::clear_row() {
+	for (size_t i = 0; i < m_columns.size(); i++) {
+		unsigned char* p = m_current.data.data() + m_column_offset[i] + m_current.rows * m_columns[i].size;
+
+		if (m_columns[i].type == TYPE_F32) {
+			float nan = NAN;
+			memcpy(p, &nan, sizeof(nan));
+		} else if (m_columns[i].type == TYPE_F64) {
+			double nan = NAN;
+			memcpy(p, &nan, sizeof(nan));
+		} else {
+			memset(p, 0, m_columns[i].size);
+		}
+	}
+}
+
+void MetadataLog::end_row() {
+	if (m_file == NULL) {
+		return;
+	}
+
+	m_current.rows++;
+	m_rows++;
+
+	if (m_current.rows == m_block_rows) {
+		queue_block();
+	}
+
+	clear_row();
+}
+
+/**
+ * Hand the current block to the writer and continue with an empty one.
+ * Only allocates if the writer has fallen behind.
+ */
+void MetadataLog::queue_block() {
+	Block next;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_free.empty()) {
+			next.data.swap(m_free.back().data);
+			m_free.pop_back();
+		} else {
+			next.data.resize(m_row_size * m_block_rows);
+		}
+
+		m_queued.push_back(Block());
+		m_queued.back().data.swap(m_current.data);
+		m_queued.back().rows = m_current.rows;
+	}
+
+	m_cv.notify_one();
+
+	m_current.data.swap(next.data);
+	m_current.rows = 0;
+}
+
+void MetadataLog::writer_main() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true) {
+		m_cv.wait(lock, [&] { return m_quit || !m_queued.empty(); });
+
+		if (m_queued.empty()) {
+			return;
+		}
+
+		Block b;
+		b.data.swap(m_queued.front().data);
+		b.rows = m_queued.front().rows;
+		m_queued.pop_front();
+
+		lock.unlock();
+
+		uint32_t header[2];
+		memcpy(&header[0], "BLK1", 4);
+		header[1] = (uint32_t)b.rows;
+		fwrite(header, sizeof(header), 1, m_file);
+
+		// Only the filled part of each column array
+		for (size_t i = 0; i < m_columns.size(); i++) {
+			fwrite(b.data.data() + m_column_offset[i], m_columns[i].size, b.rows, m_file);
+		}
+		fflush(m_file);
+
+		lock.lock();
+		m_free.push_back(Block());
+		m_free.back().data.swap(b.data);
+	}
+}
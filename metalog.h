@@ -0,0 +1,104 @@
+#ifndef METALOG_H__
+#define METALOG_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Append-only columnar binary log of per-frame values, for offline analysis
+ * of long runs.
+ *
+ * Rows are collected into blocks of m_block_rows rows, stored column by
+ * column, and full blocks are written by a background thread. File layout,
+ * little endian:
+ *
+ *   "RSML" u32 version, u32 column count,
+ *   per column: u8 type, u8 name length, name
+ *   blocks: "BLK1" u32 rows, then each column's values as one array
+ *
+ * so a reader can map every column of a block straight into an array, e.g.
+ * numpy.frombuffer.
+ */
+class MetadataLog {
+public:
+	enum Type {
+		TYPE_U64,
+		TYPE_I32,
+		TYPE_F32,
+		TYPE_F64
+	};
+
+	MetadataLog(int block_rows = 4096);
+	virtual ~MetadataLog();
+
+	/**
+	 * Define a column, before open(). Returns its index for set_*().
+	 */
+	int add_column(const char* name, Type type);
+
+	bool open(const std::string& path);
+
+	/**
+	 * Write the partial block and close the file
+	 */
+	void close();
+
+	bool is_open() const { return m_file != NULL; }
+
+	// Values of the current row, unset values are 0 (integers) or NaN
+	void set_u64(int col, uint64_t v) { set(col, &v, sizeof(v)); }
+	void set_i32(int col, int32_t v) { set(col, &v, sizeof(v)); }
+	void set_f32(int col, float v) { set(col, &v, sizeof(v)); }
+	void set_f64(int col, double v) { set(col, &v, sizeof(v)); }
+
+	/**
+	 * Finish the current row
+	 */
+	void end_row();
+
+	uint64_t rows() const { return m_rows; }
+
+	const int m_block_rows;
+
+private:
+	struct Column {
+		std::string name;
+		Type type;
+		size_t size;
+	};
+
+	// One block, column arrays back to back
+	struct Block {
+		std::vector<unsigned char> data;
+		int rows;
+	};
+
+	void set(int col, const void* v, size_t size);
+	void clear_row();
+	void queue_block();
+	void writer_main();
+
+	std::vector<Column> m_columns;
+	std::vector<size_t> m_column_offset;
+	size_t m_row_size;
+	FILE* m_file;
+
+	Block m_current;
+	uint64_t m_rows;
+
+	std::deque<Block> m_queued;
+	std::vector<Block> m_free;
+	std::thread m_writer;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_quit;
+};
+
+#endif // METALOG_H__
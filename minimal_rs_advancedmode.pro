@@ -4,6 +4,66 @@ CONFIG -= app_bundle
 CONFIG -= qt
 
 SOURCES += \
-        main.cpp
+        main.cpp \
+        assembler.cpp \
+        background.cpp \
+        blobs.cpp \
+        clocksync.cpp \
+        colorframe.cpp \
+        colorizer.cpp \
+        controlseq.cpp \
+        devicecache.cpp \
+        eventbuffer.cpp \
+        framechange.cpp \
+        framemeta.cpp \
+        framering.cpp \
+        heightmap.cpp \
+        imu.cpp \
+        jpegencoder.cpp \
+        metalog.cpp \
+        numa.cpp \
+        recorder.cpp \
+        recovery.cpp \
+        roicontrol.cpp \
+        sensorstreams.cpp \
+        shutdown.cpp \
+        startup.cpp \
+        workerpool.cpp
+
+HEADERS += \
+        realsensesettings.h \
+        assembler.h \
+        background.h \
+        blobs.h \
+        clocksync.h \
+        colorframe.h \
+        colorizer.h \
+        controlseq.h \
+        devicecache.h \
+        eventbuffer.h \
+        framechange.h \
+        framemeta.h \
+        framering.h \
+        heightmap.h \
+        imu.h \
+        jpegencoder.h \
+        metalog.h \
+        numa.h \
+        recorder.h \
+        recovery.h \
+        roicontrol.h \
+        sensorstreams.h \
+        shutdown.h \
+        spscring.h \
+        startup.h \
+        workerpool.h
 
 INCLUDEPATH += /home/gekko/librealsense/include
+
+# libjpeg-turbo, remove both lines to build without JPEG support
+DEFINES += HAVE_TURBOJPEG
+LIBS += -lturbojpeg
+
+# liburing, uncomment both lines to record with io_uring
+# DEFINES += HAVE_LIBURING
+# LIBS += -luring
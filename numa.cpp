@@ -0,0 +1,376 @@
+#include "numa.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+// From <numaif.h>, which is only installed with libnuma
+#define NUMA_MPOL_PREFERRED 1
+
+/**
+ * First line of a small sysfs file, empty if it cannot be read
+ */
+static std::string read_line(const std::string& path) {
+	char buf[4096];
+	FILE* f = fopen(path.c_str(), "r");
+	if (f == NULL) {
+		return std::string();
+	}
+
+	std::string line;
+	if (fgets(buf, sizeof(buf), f) != NULL) {
+		line = buf;
+		line.erase(line.find_last_not_of(" \r\n") + 1);
+	}
+
+	fclose(f);
+	return line;
+}
+
+/**
+ * Highest id in a sysfs list such as "0-3,8-11" plus one, 0 if empty.
+ * Calls fn for every id.
+ */
+template <class F>
+static int parse_list(const std::string& list, F fn) {
+	int count = 0;
+	const char* p = list.c_str();
+
+	while (*p) {
+		char* end;
+		long first = strtol(p, &end, 10);
+		if (end == p) {
+			break;
+		}
+
+		long last = first;
+		p = end;
+		if (*p == '-') {
+			last = strtol(p + 1, &end, 10);
+			p = end;
+		}
+
+		for (long i = first; i <= last; i++) {
+			fn((int)i);
+		}
+
+		if (last + 1 > count) {
+			count = (int)last + 1;
+		}
+
+		if (*p == ',') {
+			p++;
+		}
+	}
+
+	return count;
+}
+
+int numa_node_count() {
+	int count = parse_list(read_line("/sys/devices/system/node/online"), [](int) {});
+	return count > 0 ? count : 1;
+}
+
+int numa_node_of_path(const std::string& path) {
+	// Walk up towards the PCI device, which is the first to know its node
+	std::string dir = path;
+
+	while (dir.size() > 1) {
+		std::string node = read_line(dir + "/numa_node");
+		if (!node.empty()) {
+			int n = atoi(node.c_str());
+			if (n >= 0) {
+				return n;
+			}
+		}
+
+		size_t slash = dir.find_last_of('/');
+		if (slash == std::string::npos || slash == 0) {
+			break;
+		}
+		dir.erase(slash);
+	}
+
+	return -1;
+}
+
+bool numa_pin_current_thread(int node) {
+	if (node < 0) {
+		return true;
+	}
+
+#ifdef __linux__
+	char path[64];
+	snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	int n = parse_list(read_line(path), [&](int cpu) {
+		if (cpu < CPU_SETSIZE) {
+			CPU_SET(cpu, &cpus);
+		}
+	});
+
+	return n > 0 && pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+#else
+	return false;
+#endif
+}
+
+#ifdef __linux__
+/**
+ * Anonymous mapping of size bytes aligned to align, trimming the excess
+ */
+static void* map_aligned(size_t size, size_t align) {
+	void* p = mmap(NULL, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		return NULL;
+	}
+
+	uintptr_t start = ((uintptr_t)p + align - 1) & ~(uintptr_t)(align - 1);
+	size_t head = start - (uintptr_t)p;
+	if (head) {
+		munmap(p, head);
+	}
+	if (align - head) {
+		munmap((void*)(start + size), align - head);
+	}
+
+	return (void*)start;
+}
+#endif
+
+NumaSlab::NumaSlab(size_t size, int node, bool huge_pages) {
+	m_size = size;
+	m_used = 0;
+	m_node = node;
+	m_bound = false;
+	m_pages = PAGES_NORMAL;
+	m_mem = NULL;
+
+#ifdef __linux__
+	if (huge_pages) {
+		// Reserved huge pages first, then transparent ones, which need 2 MB alignment
+		size_t huge_size = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+		void* p = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			m_mem = (unsigned char*)p;
+			m_pages = PAGES_HUGETLB;
+		} else {
+			m_mem = (unsigned char*)map_aligned(huge_size, HUGE_PAGE_SIZE);
+			if (m_mem && madvise(m_mem, huge_size, MADV_HUGEPAGE) == 0) {
+				m_pages = PAGES_TRANSPARENT;
+			}
+		}
+
+		if (m_mem) {
+			m_size = huge_size;
+		}
+	} else {
+		void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		m_mem = p == MAP_FAILED ? NULL : (unsigned char*)p;
+	}
+
+	// Preferred rather than strict binding, a full node falls back to the others
+	if (m_mem && node >= 0 && node < 64) {
+		unsigned long mask = 1UL << node;
+		m_bound = syscall(SYS_mbind, m_mem, m_size, NUMA_MPOL_PREFERRED, &mask, 64, 0) == 0;
+	}
+#else
+	(void)huge_pages;
+	m_mem = (unsigned char*)malloc(size);
+#endif
+
+	if (m_mem == NULL) {
+		std::cout << "failed allocating " << size << " byte slab" << std::endl;
+		m_size = 0;
+	}
+}
+
+const char* NumaSlab::pages_name() const {
+	switch (m_pages) {
+		case PAGES_HUGETLB: return "2 MB huge pages";
+		case PAGES_TRANSPARENT: return "transparent huge pages";
+		default: return "4 kB pages";
+	}
+}
+
+NumaSlab::~NumaSlab() {
+	if (m_mem == NULL) {
+		return;
+	}
+
+#ifdef __linux__
+	munmap(m_mem, m_size);
+#else
+	free(m_mem);
+#endif
+}
+
+void* NumaSlab::alloc(size_t size) {
+	size_t start = (m_used + 63) & ~(size_t)63;
+	if (m_mem == NULL || start + size > m_size) {
+		return NULL;
+	}
+
+	m_used = start + size;
+	return m_mem + start;
+}
+
+void numa_copy_benchmark(int local_node, size_t bytes) {
+	int nodes = numa_node_count();
+	int rounds = 20;
+
+	if (!numa_pin_current_thread(local_node)) {
+		std::cout << "copy benchmark thread not pinned to node " << local_node << std::endl;
+	}
+
+	NumaSlab dst_slab(bytes, local_node);
+	void* dst = dst_slab.alloc(bytes);
+	if (dst == NULL) {
+		return;
+	}
+	memset(dst, 0, bytes);
+
+	for (int n = 0; n < nodes; n++) {
+		NumaSlab src_slab(bytes, n);
+		void* src = src_slab.alloc(bytes);
+		if (src == NULL) {
+			continue;
+		}
+		memset(src, 1, bytes);
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < rounds; i++) {
+			memcpy(dst, src, bytes);
+		}
+		double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		std::cout << "copy node " << n << " -> node " << local_node << ": "
+			<< (double)bytes * rounds / s / 1e9 << " GB/s"
+			<< (src_slab.bound() ? "" : " (placement not bound)") << std::endl;
+	}
+}
+
+/**
+ * Counter of data TLB read misses of the calling thread, -1 if perf events
+ * are not available (e.g. kernel.perf_event_paranoid or containers)
+ */
+static int open_dtlb_counter() {
+#ifdef __linux__
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+static void counter_start(int fd) {
+#ifdef __linux__
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+#else
+	(void)fd;
+#endif
+}
+
+static long long counter_stop(int fd) {
+	long long count = -1;
+#ifdef __linux__
+	if (fd >= 0) {
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &count, sizeof(count)) != sizeof(count)) {
+			count = -1;
+		}
+	}
+#else
+	(void)fd;
+#endif
+	return count;
+}
+
+void page_size_benchmark(size_t bytes, size_t frame_size) {
+	int fd = open_dtlb_counter();
+	if (fd < 0) {
+		std::cout << "perf events not available, TLB misses are not counted" << std::endl;
+	}
+
+	std::vector<unsigned char> frame(frame_size, 1);
+
+	for (int huge = 0; huge < 2; huge++) {
+		NumaSlab slab(bytes, -1, huge != 0);
+		unsigned char* mem = (unsigned char*)slab.alloc(bytes);
+		if (mem == NULL) {
+			continue;
+		}
+		memset(mem, 0, bytes);
+
+		// Frames pushed through a ring spanning the whole slab
+		size_t slots = bytes / frame_size;
+		int passes = 4;
+
+		counter_start(fd);
+		auto start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < passes; pass++) {
+			for (size_t i = 0; i < slots; i++) {
+				memcpy(mem + i * frame_size, frame.data(), frame_size);
+			}
+		}
+		double copy_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		long long copy_misses = counter_stop(fd);
+
+		// One read per 4 kB page in a scattered order, the worst case for the TLB
+		size_t pages = bytes / 4096;
+		size_t step = pages % 7919 ? 7919 : 1; // coprime, visits every page once
+		volatile unsigned char sink = 0;
+
+		counter_start(fd);
+		start = std::chrono::steady_clock::now();
+		for (size_t i = 0, page = 0; i < pages; i++, page = (page + step) % pages) {
+			sink += mem[page * 4096];
+		}
+		double walk_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		long long walk_misses = counter_stop(fd);
+		(void)sink;
+
+		std::cout << slab.pages_name() << ": ring copy " << (double)slots * frame_size * passes / copy_s / 1e9
+			<< " GB/s, page walk " << walk_s * 1e9 / pages << " ns / page";
+		if (fd >= 0) {
+			std::cout << ", dTLB misses copy / walk: " << copy_misses << " / " << walk_misses;
+		}
+		std::cout << std::endl;
+	}
+
+#ifdef __linux__
+	if (fd >= 0) {
+		close(fd);
+	}
+#endif
+}
@@ -0,0 +1,98 @@
+#ifndef NUMA_H__
+#define NUMA_H__
+
+#include <stddef.h>
+#include <string>
+
+/**
+ * NUMA placement helpers for multi-socket capture hosts, using sysfs and the
+ * mbind system call directly instead of depending on libnuma. Everything
+ * degrades to plain allocation and unpinned threads on single node hosts
+ * and on other platforms.
+ */
+
+/** Amount of NUMA nodes, 1 if unknown */
+int numa_node_count();
+
+/**
+ * Node of the PCI device (e.g. the USB controller) a sysfs device path such
+ * as RS2_CAMERA_INFO_PHYSICAL_PORT is attached to. -1 if unknown.
+ */
+int numa_node_of_path(const std::string& path);
+
+/**
+ * Restrict the calling thread to the CPUs of a node. Returns false if not
+ * possible. node < 0 is a no-op.
+ */
+bool numa_pin_current_thread(int node);
+
+/**
+ * One contiguous allocation with its pages placed on a NUMA node, carved
+ * into buffers for one camera. Pages are placed when first touched, so the
+ * caller should initialize the buffers. Freed as a whole on destruction.
+ *
+ * Optionally backed by 2 MB pages, so deep frame rings need far fewer TLB
+ * entries: reserved hugetlbfs pages if the system has them, otherwise
+ * transparent huge pages, otherwise normal pages.
+ */
+class NumaSlab {
+public:
+	enum Pages {
+		PAGES_NORMAL,
+		PAGES_TRANSPARENT,
+		PAGES_HUGETLB
+	};
+
+	static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	/**
+	 * node < 0 allocates without placement. With huge_pages the size is
+	 * rounded up to whole 2 MB pages.
+	 */
+	NumaSlab(size_t size, int node, bool huge_pages = false);
+	virtual ~NumaSlab();
+
+	/**
+	 * Next size bytes of the slab, 64 byte aligned. NULL once it is full.
+	 */
+	void* alloc(size_t size);
+
+	size_t size() const { return m_size; }
+	size_t used() const { return m_used; }
+	int node() const { return m_node; }
+
+	/** True if the pages are bound to the node */
+	bool bound() const { return m_bound; }
+
+	/** Kind of pages backing the slab. Transparent huge pages are only a request to the kernel. */
+	Pages pages() const { return m_pages; }
+	const char* pages_name() const;
+
+private:
+	NumaSlab(const NumaSlab&);
+	NumaSlab& operator=(const NumaSlab&);
+
+	unsigned char* m_mem;
+	size_t m_size;
+	size_t m_used;
+	int m_node;
+	bool m_bound;
+	Pages m_pages;
+};
+
+/**
+ * Print copy throughput into a buffer on local_node from a buffer on each
+ * node, with the calling thread pinned to local_node. Shows what keeping
+ * frames on the camera's node saves.
+ */
+void numa_copy_benchmark(int local_node, size_t bytes);
+
+/**
+ * Print ring copy throughput and data TLB misses of slabs backed by normal
+ * and by huge pages: frame_size copies through a bytes sized ring, then a
+ * scattered read of every 4 kB page. Misses are counted with perf events
+ * where the kernel allows it.
+ */
+void page_size_benchmark(size_t bytes, size_t frame_size);
+
+#endif // NUMA_H__
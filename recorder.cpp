@@ -0,0 +1,569 @@
+#include "recorder.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+
+#ifdef WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBURING
+// user_data of the no-op which tells the completion thread to exit
+static const uintptr_t URING_QUIT = ~(uintptr_t)0;
+#endif
+
+static size_t round_up(size_t n, size_t align) {
+	return (n + align - 1) / align * align;
+}
+
+#ifdef WIN32
+// The CRT has no pwrite, positioned writes seek and write under this lock
+static std::mutex g_seek_mutex;
+#endif
+
+/**
+ * Create or truncate path for writing, with O_DIRECT if direct is set and
+ * the file system supports it; direct is cleared if not. -1 on failure.
+ */
+static int open_output(const std::string& path, bool append, bool& direct) {
+#ifdef WIN32
+	direct = false;
+	return _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY | (append ? _O_APPEND : 0),
+		_S_IREAD | _S_IWRITE);
+#else
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | (append ? O_APPEND : 0);
+
+	// O_DIRECT skips the page cache, but e.g. tmpfs does not support it
+#ifdef O_DIRECT
+	if (direct) {
+		int fd = open(path.c_str(), flags | O_DIRECT, 0644);
+		if (fd >= 0 || errno != EINVAL) {
+			return fd;
+		}
+	}
+#endif
+
+	direct = false;
+	return open(path.c_str(), flags, 0644);
+#endif
+}
+
+/**
+ * Write all size bytes of data at offset. Returns false with errno set on failure.
+ */
+static bool write_at(int fd, const unsigned char* data, size_t size, uint64_t offset) {
+#ifdef WIN32
+	std::lock_guard<std::mutex> lock(g_seek_mutex);
+	if (_lseeki64(fd, offset, SEEK_SET) < 0) {
+		return false;
+	}
+#endif
+
+	size_t done = 0;
+	while (done < size) {
+#ifdef WIN32
+		int n = _write(fd, data + done, (unsigned int)(size - done));
+#else
+		ssize_t n = pwrite(fd, data + done, size - done, offset + done);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+#endif
+		if (n <= 0) {
+			return false;
+		}
+		done += n;
+	}
+
+	return true;
+}
+
+static bool append_all(int fd, const void* data, size_t size) {
+#ifdef WIN32
+	return _write(fd, data, (unsigned int)size) == (int)size;
+#else
+	return write(fd, data, size) == (ssize_t)size;
+#endif
+}
+
+static bool sync_file(int fd) {
+#ifdef WIN32
+	return _commit(fd) == 0;
+#else
+	return fdatasync(fd) == 0;
+#endif
+}
+
+static void close_file(int fd) {
+#ifdef WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+uint32_t record_checksum(const void* data, size_t size) {
+	// FNV-1a over 32 bit words, bytewise for the tail
+	const unsigned char* p = (const unsigned char*)data;
+	uint32_t h = 2166136261u;
+	size_t i = 0;
+
+	for (; i + 4 <= size; i += 4) {
+		uint32_t w;
+		memcpy(&w, p + i, 4);
+		h = (h ^ w) * 16777619u;
+	}
+	for (; i < size; i++) {
+		h = (h ^ p[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+Recorder::Recorder(size_t max_frame_size, int slots, Backend backend)
+	: m_pool(round_up(sizeof(RecordHeader) + max_frame_size, RECORD_ALIGN) * slots, -1)
+{
+	m_batch = 4;
+	m_pwrite_threads = 2;
+	m_checkpoint_ms = 1000;
+
+	m_slot_size = round_up(sizeof(RecordHeader) + max_frame_size, RECORD_ALIGN);
+	m_backend = backend;
+	m_active = BACKEND_PWRITE;
+	m_fd = -1;
+	m_direct = false;
+	m_offset = 0;
+	m_quit = false;
+
+	m_written = 0;
+	m_written_bytes = 0;
+	m_dropped = 0;
+	m_errors = 0;
+	m_stats_frames = 0;
+	m_stats_bytes = 0;
+
+	m_journal_fd = -1;
+	m_journal_entries = 0;
+	m_checkpointed = 0;
+	m_journal_quit = false;
+
+#ifdef HAVE_LIBURING
+	m_fixed_buffers = false;
+	m_unsubmitted = 0;
+#endif
+
+	// The pool is one page aligned mapping, slot sizes are multiples of RECORD_ALIGN
+	m_slots.resize(slots);
+	for (int i = 0; i < slots; i++) {
+		m_slots[i].data = (unsigned char*)m_pool.alloc(m_slot_size);
+		m_slots[i].record_size = 0;
+		m_slots[i].offset = 0;
+
+		if (m_slots[i].data) {
+			memset(m_slots[i].data, 0, m_slot_size);
+			m_free.push_back(i);
+		}
+	}
+}
+
+Recorder::~Recorder() {
+	close();
+}
+
+const char* Recorder::backend_name() const {
+	return m_active == BACKEND_URING ? "io_uring" : "pwrite";
+}
+
+bool Recorder::open(const std::string& path) {
+	close();
+
+	m_direct = true;
+	m_fd = open_output(path, false, m_direct);
+	if (m_fd < 0) {
+		std::cout << "Failed opening recording " << path << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	std::string journal = path + ".idx";
+	bool journal_direct = false;
+	m_journal_fd = open_output(journal, true, journal_direct);
+	if (m_journal_fd < 0) {
+		std::cout << "Failed opening recording index " << journal << ": " << strerror(errno) << std::endl;
+		close_file(m_fd);
+		m_fd = -1;
+		return false;
+	}
+
+	m_journal_entries = 0;
+	m_checkpointed = 0;
+	m_journal_quit = false;
+	m_journal_thread = std::thread(&Recorder::journal_main, this);
+
+	m_offset = 0;
+	m_quit = false;
+	m_active = BACKEND_PWRITE;
+
+#ifdef HAVE_LIBURING
+	if (m_backend != BACKEND_PWRITE && uring_start()) {
+		m_active = BACKEND_URING;
+	}
+#endif
+
+	if (m_active == BACKEND_PWRITE) {
+		if (m_backend == BACKEND_URING) {
+			std::cout << "io_uring not available, recording with pwrite" << std::endl;
+		}
+
+		for (int i = 0; i < m_pwrite_threads; i++) {
+			m_threads.push_back(std::thread(&Recorder::pwrite_main, this));
+		}
+	}
+
+	std::cout << "Recording to " << path << " with " << backend_name()
+		<< (m_direct ? ", O_DIRECT" : "") << std::endl;
+	return true;
+}
+
+void Recorder::close() {
+	if (m_fd < 0) {
+		return;
+	}
+
+	flush();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+
+#ifdef HAVE_LIBURING
+		if (m_active == BACKEND_URING) {
+			struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+			io_uring_prep_nop(sqe);
+			io_uring_sqe_set_data(sqe, (void*)URING_QUIT);
+			io_uring_submit(&m_ring);
+		}
+#endif
+	}
+
+	m_cv.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i].join();
+	}
+	m_threads.clear();
+
+#ifdef HAVE_LIBURING
+	if (m_active == BACKEND_URING) {
+		if (m_fixed_buffers) {
+			io_uring_unregister_buffers(&m_ring);
+		}
+		io_uring_queue_exit(&m_ring);
+	}
+#endif
+
+	// Final checkpoint covers every entry
+	{
+		std::lock_guard<std::mutex> lock(m_journal_mutex);
+		m_journal_quit = true;
+	}
+	m_journal_cv.notify_all();
+	m_journal_thread.join();
+
+	// O_DIRECT writes are padded, the last record's padding is left in place
+	close_file(m_journal_fd);
+	m_journal_fd = -1;
+	close_file(m_fd);
+	m_fd = -1;
+}
+
+bool Recorder::submit(const void* data, size_t size, uint64_t frame_number, double timestamp) {
+	if (m_fd < 0 || sizeof(RecordHeader) + size > m_slot_size) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_dropped++;
+		return false;
+	}
+
+	int slot;
+	size_t record_size = round_up(sizeof(RecordHeader) + size, RECORD_ALIGN);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_free.empty()) {
+			m_dropped++;
+			return false;
+		}
+
+		slot = m_free.back();
+		m_free.pop_back();
+
+		m_slots[slot].offset = m_offset;
+		m_slots[slot].record_size = record_size;
+		m_offset += record_size;
+	}
+
+	// slot is owned by this thread until queued
+	Slot& s = m_slots[slot];
+	RecordHeader* h = (RecordHeader*)s.data;
+	memset(h, 0, sizeof(RecordHeader));
+	h->magic = MAGIC;
+	h->header_size = sizeof(RecordHeader);
+	h->frame_number = frame_number;
+	h->timestamp = timestamp;
+	h->size = size;
+	h->record_size = record_size;
+	h->checksum = record_checksum(data, size);
+	memcpy(s.data + sizeof(RecordHeader), data, size);
+	memset(s.data + sizeof(RecordHeader) + size, 0, record_size - sizeof(RecordHeader) - size);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+#ifdef HAVE_LIBURING
+	if (m_active == BACKEND_URING) {
+		struct io_uring_sqe* sqe = io_uring_get_sqe(&m_ring);
+		if (sqe == NULL) {
+			// submission queue full, hand the batch to the kernel and retry
+			uring_submit_pending();
+			sqe = io_uring_get_sqe(&m_ring);
+		}
+
+		if (m_fixed_buffers) {
+			io_uring_prep_write_fixed(sqe, m_fd, s.data, record_size, s.offset, 0);
+		} else {
+			io_uring_prep_write(sqe, m_fd, s.data, record_size, s.offset);
+		}
+		io_uring_sqe_set_data(sqe, (void*)(uintptr_t)slot);
+
+		if (++m_unsubmitted >= m_batch) {
+			uring_submit_pending();
+		}
+		return true;
+	}
+#endif
+
+	m_queued.push_back(slot);
+	m_cv.notify_one();
+	return true;
+}
+
+void Recorder::flush() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+#ifdef HAVE_LIBURING
+	if (m_active == BACKEND_URING && m_fd >= 0) {
+		uring_submit_pending();
+	}
+#endif
+
+	m_cv_idle.wait(lock, [&] { return m_free.size() == m_slots.size() || m_fd < 0; });
+}
+
+/**
+ * Return a slot to the pool once its write finished
+ */
+void Recorder::release(int slot, bool ok) {
+	if (ok) {
+		const RecordHeader* h = (const RecordHeader*)m_slots[slot].data;
+		IndexEntry e;
+		memset(&e, 0, sizeof(e));
+		e.magic = INDEX_MAGIC;
+		e.type = INDEX_ENTRY;
+		e.frame_number = h->frame_number;
+		e.timestamp = h->timestamp;
+		e.offset = m_slots[slot].offset;
+		e.record_size = m_slots[slot].record_size;
+		e.payload_checksum = h->checksum;
+		journal_append(e);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (ok) {
+		m_written++;
+		m_written_bytes += m_slots[slot].record_size;
+	} else {
+		m_errors++;
+	}
+
+	m_free.push_back(slot);
+	if (m_free.size() == m_slots.size()) {
+		m_cv_idle.notify_all();
+	}
+}
+
+void Recorder::pwrite_main() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true) {
+		m_cv.wait(lock, [&] { return m_quit || !m_queued.empty(); });
+
+		if (m_queued.empty()) {
+			return;
+		}
+
+		int slot = m_queued.front();
+		m_queued.pop_front();
+		Slot s = m_slots[slot];
+
+		lock.unlock();
+
+		bool ok = write_at(m_fd, s.data, s.record_size, s.offset);
+		if (!ok) {
+			std::cout << "Recording write failed: " << strerror(errno) << std::endl;
+		}
+
+		release(slot, ok);
+		lock.lock();
+	}
+}
+
+void Recorder::journal_append(const IndexEntry& entry) {
+	IndexEntry e = entry;
+	e.checksum = record_checksum(&e, offsetof(IndexEntry, checksum));
+
+	std::lock_guard<std::mutex> lock(m_journal_mutex);
+
+	// O_APPEND, entries are small enough to never be split by other appends
+	if (!append_all(m_journal_fd, &e, sizeof(e))) {
+		std::cout << "Recording index write failed: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	if (e.type == INDEX_ENTRY) {
+		m_journal_entries++;
+	}
+}
+
+/**
+ * Make every entry appended so far durable, then say so with a checkpoint
+ */
+void Recorder::checkpoint() {
+	uint64_t entries;
+	{
+		std::lock_guard<std::mutex> lock(m_journal_mutex);
+		entries = m_journal_entries;
+	}
+
+	if (entries == m_checkpointed) {
+		return;
+	}
+
+	// Entries only exist for completed writes, syncing afterwards covers them
+	if (!sync_file(m_fd) || !sync_file(m_journal_fd)) {
+		std::cout << "Recording sync failed: " << strerror(errno) << std::endl;
+		return;
+	}
+
+	IndexEntry e;
+	memset(&e, 0, sizeof(e));
+	e.magic = INDEX_MAGIC;
+	e.type = INDEX_CHECKPOINT;
+	e.frame_number = entries;
+	journal_append(e);
+	m_checkpointed = entries;
+}
+
+void Recorder::journal_main() {
+	std::unique_lock<std::mutex> lock(m_journal_mutex);
+
+	while (!m_journal_quit) {
+		m_journal_cv.wait_for(lock, std::chrono::milliseconds(m_checkpoint_ms));
+
+		lock.unlock();
+		checkpoint();
+		lock.lock();
+	}
+
+	lock.unlock();
+	checkpoint();
+	sync_file(m_journal_fd);
+}
+
+#ifdef HAVE_LIBURING
+
+bool Recorder::uring_start() {
+	if (io_uring_queue_init(m_slots.size() + 1, &m_ring, 0) < 0) {
+		return false;
+	}
+
+	// Registered buffers save pinning the pages on every write. Needs enough
+	// RLIMIT_MEMLOCK, otherwise plain writes from the same pool are used.
+	struct iovec iov;
+	iov.iov_base = m_slots.empty() ? NULL : m_slots[0].data;
+	iov.iov_len = m_slot_size * m_slots.size();
+	m_fixed_buffers = io_uring_register_buffers(&m_ring, &iov, 1) == 0;
+	m_unsubmitted = 0;
+
+	m_threads.push_back(std::thread(&Recorder::uring_main, this));
+	return true;
+}
+
+/**
+ * Hand queued writes to the kernel. Called with m_mutex held.
+ */
+void Recorder::uring_submit_pending() {
+	if (m_unsubmitted == 0) {
+		return;
+	}
+
+	int ret = io_uring_submit(&m_ring);
+	if (ret < 0) {
+		std::cout << "io_uring_submit failed: " << strerror(-ret) << std::endl;
+	}
+	m_unsubmitted = 0;
+}
+
+void Recorder::uring_main() {
+	while (true) {
+		struct io_uring_cqe* cqe;
+		int ret = io_uring_wait_cqe(&m_ring, &cqe);
+		if (ret == -EINTR) {
+			continue;
+		}
+		if (ret < 0) {
+			std::cout << "io_uring_wait_cqe failed: " << strerror(-ret) << std::endl;
+			return;
+		}
+
+		uintptr_t slot = (uintptr_t)io_uring_cqe_get_data(cqe);
+		int res = cqe->res;
+		io_uring_cqe_seen(&m_ring, cqe);
+
+		if (slot == URING_QUIT) {
+			return;
+		}
+
+		// A short write, e.g. on a full disk, counts as failed
+		bool ok = res == (int)m_slots[slot].record_size;
+		if (!ok) {
+			std::cout << "Recording write failed: " << (res < 0 ? strerror(-res) : "short write") << std::endl;
+		}
+
+		release((int)slot, ok);
+	}
+}
+
+#endif // HAVE_LIBURING
+
+void Recorder::print_stats() {
+	uint64_t frames, bytes, dropped, errors;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		frames = m_written - m_stats_frames;
+		bytes = m_written_bytes - m_stats_bytes;
+		m_stats_frames = m_written;
+		m_stats_bytes = m_written_bytes;
+		dropped = m_dropped;
+		errors = m_errors;
+	}
+
+	std::cout << "recorder (" << backend_name() << "): " << frames << " frames, "
+		<< bytes / (1024 * 1024) << " MB written, " << dropped << " dropped, "
+		<< errors << " write errors" << std::endl;
+}
@@ -0,0 +1,192 @@
+#ifndef RECORDER_H__
+#define RECORDER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+#include "numa.h"
+
+/**
+ * Header in front of every frame in a recording. Records are padded to
+ * RECORD_ALIGN bytes so they can be written with O_DIRECT.
+ */
+struct RecordHeader {
+	uint32_t magic;
+	uint32_t header_size;
+	uint64_t frame_number;
+	double timestamp;
+	uint64_t size;          // payload bytes following the header
+	uint64_t record_size;   // header, payload and padding
+	uint32_t checksum;      // record_checksum() of the payload
+	uint8_t reserved[20];
+};
+
+/**
+ * Entry of the index journal next to a recording (<path>.idx). An entry is
+ * appended once a record's write has completed, in completion order.
+ *
+ * Periodically the recording and the journal are synced and a checkpoint
+ * is appended: every entry before it is durable and needs no verification
+ * on recovery. Entries after the last checkpoint are checked against the
+ * recording.
+ */
+struct IndexEntry {
+	uint32_t magic;
+	uint32_t type;
+	uint64_t frame_number;  // checkpoints: amount of entries before it
+	double timestamp;
+	uint64_t offset;
+	uint64_t record_size;
+	uint32_t payload_checksum;
+	uint32_t checksum;      // record_checksum() of the fields above
+};
+
+/**
+ * Cheap checksum for detecting torn or missing writes, not cryptographic
+ */
+uint32_t record_checksum(const void* data, size_t size);
+
+/**
+ * Asynchronous frame recorder which never blocks the capture thread on disk.
+ *
+ * Frames are copied into slots of a page aligned pool and written to one
+ * file with O_DIRECT where the file system supports it. Slots go back to the
+ * pool when their write completes; with every slot in flight new frames are
+ * dropped, not waited for.
+ *
+ * With liburing (HAVE_LIBURING) writes are queued on an io_uring from the
+ * registered pool buffers and submitted in batches, and a completion thread
+ * returns the slots. Elsewhere, or if the kernel refuses io_uring, writer
+ * threads call pwrite. Windows has neither pwrite nor O_DIRECT; its writer
+ * threads take turns seeking and writing with the CRT.
+ */
+class Recorder {
+public:
+	enum Backend {
+		BACKEND_AUTO,
+		BACKEND_URING,
+		BACKEND_PWRITE
+	};
+
+	static const uint32_t MAGIC = 0x31435352; // "RSC1"
+	static const uint32_t INDEX_MAGIC = 0x31495352; // "RSI1"
+	static const uint32_t INDEX_ENTRY = 0;
+	static const uint32_t INDEX_CHECKPOINT = 1;
+	static const size_t RECORD_ALIGN = 4096;
+
+	Recorder(size_t max_frame_size, int slots, Backend backend = BACKEND_AUTO);
+	virtual ~Recorder();
+
+	/**
+	 * Create or truncate the file and its index journal and start the
+	 * backend. Returns false on failure.
+	 */
+	bool open(const std::string& path);
+
+	/**
+	 * Queue a frame for writing. Returns false and drops the frame if every
+	 * slot is in flight, the frame is too large or no file is open.
+	 */
+	bool submit(const void* data, size_t size, uint64_t frame_number, double timestamp);
+
+	/**
+	 * Submit any partial batch and wait until every queued frame is on disk
+	 */
+	void flush();
+
+	/**
+	 * Flush, stop the backend and close the file
+	 */
+	void close();
+
+	bool is_open() const { return m_fd >= 0; }
+	const char* backend_name() const;
+
+	uint64_t written() const { return m_written; }
+	uint64_t dropped() const { return m_dropped; }
+	uint64_t errors() const { return m_errors; }
+
+	/**
+	 * Print frames and MB written since the previous call, and drops
+	 */
+	void print_stats();
+
+	// io_uring: frames queued before submitting them together
+	int m_batch;
+
+	// pwrite: amount of writer threads
+	int m_pwrite_threads;
+
+	// Interval of index journal checkpoints
+	int m_checkpoint_ms;
+
+private:
+	struct Slot {
+		unsigned char* data;
+		size_t record_size;
+		uint64_t offset;
+	};
+
+	void release(int slot, bool ok);
+	void pwrite_main();
+	void journal_append(const IndexEntry& e);
+	void checkpoint();
+	void journal_main();
+
+#ifdef HAVE_LIBURING
+	bool uring_start();
+	void uring_submit_pending();
+	void uring_main();
+#endif
+
+	NumaSlab m_pool;
+	size_t m_slot_size;
+	std::vector<Slot> m_slots;
+	std::vector<int> m_free;
+	std::deque<int> m_queued;
+	Backend m_backend;
+	Backend m_active;
+	int m_fd;
+	bool m_direct;
+	uint64_t m_offset;
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	std::condition_variable m_cv_idle;
+	bool m_quit;
+
+	uint64_t m_written;
+	uint64_t m_written_bytes;
+	uint64_t m_dropped;
+	uint64_t m_errors;
+	uint64_t m_stats_frames;
+	uint64_t m_stats_bytes;
+
+	// Index journal, appended from completion threads
+	int m_journal_fd;
+	uint64_t m_journal_entries;
+	uint64_t m_checkpointed;
+	bool m_journal_quit;
+	std::thread m_journal_thread;
+	std::mutex m_journal_mutex;
+	std::condition_variable m_journal_cv;
+
+#ifdef HAVE_LIBURING
+	struct io_uring m_ring;
+	bool m_fixed_buffers;
+	int m_unsubmitted;
+#endif
+};
+
+#endif // RECORDER_H__
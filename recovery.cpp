@@ -0,0 +1,231 @@
+#include "recovery.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <vector>
+
+#ifdef WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "recorder.h"
+
+/**
+ * Read exactly size bytes at offset. Recovery is single threaded, so on
+ * Windows, which has no pread, a seek before the read does the same.
+ */
+static bool read_at(int fd, void* data, size_t size, uint64_t offset) {
+#ifdef WIN32
+	return _lseeki64(fd, offset, SEEK_SET) >= 0 && _read(fd, data, (unsigned int)size) == (int)size;
+#else
+	return pread(fd, data, size, offset) == (ssize_t)size;
+#endif
+}
+
+static void close_file(int fd) {
+#ifdef WIN32
+	_close(fd);
+#else
+	close(fd);
+#endif
+}
+
+/**
+ * Read and check the record at offset. Fills e from its header if intact.
+ */
+static bool read_record(int fd, uint64_t offset, uint64_t file_size, std::vector<unsigned char>& buf,
+	IndexEntry& e)
+{
+	RecordHeader h;
+	if (offset + sizeof(h) > file_size || !read_at(fd, &h, sizeof(h), offset)) {
+		return false;
+	}
+
+	if (h.magic != Recorder::MAGIC || h.header_size != sizeof(RecordHeader) ||
+		h.record_size % Recorder::RECORD_ALIGN != 0 || h.record_size < sizeof(h) + h.size ||
+		offset + h.record_size > file_size)
+	{
+		return false;
+	}
+
+	buf.resize(h.size);
+	if (!read_at(fd, buf.data(), h.size, offset + sizeof(h)) ||
+		record_checksum(buf.data(), h.size) != h.checksum)
+	{
+		return false;
+	}
+
+	memset(&e, 0, sizeof(e));
+	e.magic = Recorder::INDEX_MAGIC;
+	e.type = Recorder::INDEX_ENTRY;
+	e.frame_number = h.frame_number;
+	e.timestamp = h.timestamp;
+	e.offset = offset;
+	e.record_size = h.record_size;
+	e.payload_checksum = h.checksum;
+	return true;
+}
+
+/**
+ * Journal entries up to the first torn or foreign one. trusted is set to the
+ * amount of entries covered by the last checkpoint.
+ */
+static std::vector<IndexEntry> read_journal(const std::string& path, uint64_t& trusted) {
+	std::vector<IndexEntry> entries;
+	trusted = 0;
+
+	FILE* f = fopen(path.c_str(), "rb");
+	if (f == NULL) {
+		return entries;
+	}
+
+	IndexEntry e;
+	while (fread(&e, sizeof(e), 1, f) == 1) {
+		if (e.magic != Recorder::INDEX_MAGIC ||
+			e.checksum != record_checksum(&e, offsetof(IndexEntry, checksum)))
+		{
+			break;
+		}
+
+		if (e.type == Recorder::INDEX_CHECKPOINT) {
+			trusted = std::min<uint64_t>(e.frame_number, entries.size());
+		} else {
+			entries.push_back(e);
+		}
+	}
+
+	fclose(f);
+	return entries;
+}
+
+bool recover_recording(const std::string& path) {
+	auto start = std::chrono::steady_clock::now();
+
+#ifdef WIN32
+	int fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+	struct _stat64 st;
+	bool opened = fd >= 0 && _fstat64(fd, &st) == 0;
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	bool opened = fd >= 0 && fstat(fd, &st) == 0;
+#endif
+
+	if (!opened) {
+		std::cout << "Failed opening recording " << path << ": " << strerror(errno) << std::endl;
+		if (fd >= 0) {
+			close_file(fd);
+		}
+		return false;
+	}
+
+	uint64_t file_size = st.st_size;
+	std::string journal = path + ".idx";
+
+	uint64_t trusted;
+	std::vector<IndexEntry> journal_entries = read_journal(journal, trusted);
+
+	// Intact records by offset
+	std::map<uint64_t, IndexEntry> records;
+	std::vector<unsigned char> buf;
+	int verified = 0;
+	int rejected = 0;
+	int scanned = 0;
+
+	for (size_t i = 0; i < journal_entries.size(); i++) {
+		const IndexEntry& je = journal_entries[i];
+		IndexEntry e;
+
+		if (i < trusted && je.offset + je.record_size <= file_size) {
+			records[je.offset] = je;
+		} else if (read_record(fd, je.offset, file_size, buf, e) && e.payload_checksum == je.payload_checksum) {
+			records[je.offset] = e;
+			verified++;
+		} else {
+			rejected++;
+		}
+	}
+
+	// Completed writes whose entry was lost lie in the gaps between known records
+	uint64_t offset = 0;
+	auto next = records.begin();
+
+	while (offset < file_size) {
+		while (next != records.end() && next->first < offset) {
+			++next;
+		}
+
+		if (next != records.end() && next->first == offset) {
+			offset += next->second.record_size;
+			continue;
+		}
+
+		IndexEntry e;
+		if (read_record(fd, offset, file_size, buf, e)) {
+			records[offset] = e;
+			scanned++;
+			offset += e.record_size;
+		} else {
+			offset += Recorder::RECORD_ALIGN;
+		}
+	}
+
+	close_file(fd);
+
+	// Write the new journal next to the old one and swap them
+	std::string tmp = journal + ".tmp";
+	FILE* f = fopen(tmp.c_str(), "wb");
+	if (f == NULL) {
+		std::cout << "Failed writing recording index " << tmp << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	bool ok = true;
+	for (auto it = records.begin(); it != records.end(); ++it) {
+		IndexEntry e = it->second;
+		e.checksum = record_checksum(&e, offsetof(IndexEntry, checksum));
+		ok = ok && fwrite(&e, sizeof(e), 1, f) == 1;
+	}
+
+	IndexEntry cp;
+	memset(&cp, 0, sizeof(cp));
+	cp.magic = Recorder::INDEX_MAGIC;
+	cp.type = Recorder::INDEX_CHECKPOINT;
+	cp.frame_number = records.size();
+	cp.checksum = record_checksum(&cp, offsetof(IndexEntry, checksum));
+	ok = ok && fwrite(&cp, sizeof(cp), 1, f) == 1;
+
+	ok = fflush(f) == 0 && ok;
+#ifdef WIN32
+	ok = _commit(_fileno(f)) == 0 && ok;
+#else
+	ok = fsync(fileno(f)) == 0 && ok;
+#endif
+	ok = fclose(f) == 0 && ok;
+#ifdef WIN32
+	// rename() does not replace an existing file on Windows
+	remove(journal.c_str());
+#endif
+	ok = ok && rename(tmp.c_str(), journal.c_str()) == 0;
+
+	if (!ok) {
+		std::cout << "Failed writing recording index " << journal << ": " << strerror(errno) << std::endl;
+		return false;
+	}
+
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "Recovered " << records.size() << " records of " << path << " in " << (int)ms << " ms: "
+		<< trusted << " checkpointed, " << verified << " verified and " << rejected
+		<< " rejected journal entries, " << scanned << " found by scanning" << std::endl;
+	return true;
+}
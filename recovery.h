@@ -0,0 +1,20 @@
+#ifndef RECOVERY_H__
+#define RECOVERY_H__
+
+#include <string>
+
+/**
+ * Rebuild the index journal of a recording written by Recorder, e.g. after
+ * the process died mid-recording.
+ *
+ * Entries up to the journal's last checkpoint are taken as is, the ones
+ * after it are verified against the recording, and gaps in the recording
+ * are scanned for complete records which never made it into the journal.
+ * The journal is then replaced with a sorted and checkpointed one listing
+ * every intact record.
+ *
+ * Returns false if the recording cannot be read or the index not written.
+ */
+bool recover_recording(const std::string& path);
+
+#endif // RECOVERY_H__
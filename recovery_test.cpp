@@ -0,0 +1,218 @@
+/**
+ * Crash test for recording recovery: a child process records frames with a
+ * Recorder and is SIGKILLed at a random point, then recover_recording() is
+ * run on what it left behind. The rebuilt index must be sorted, end with a
+ * checkpoint, and list every intact record of the file and nothing else, with
+ * each payload matching what the writer generated for its frame number.
+ *
+ * Usage: recovery_test [runs] [directory]
+ */
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "recorder.h"
+#include "recovery.h"
+
+static const size_t frame_size = 640 * 480 * 2;
+
+/**
+ * Payload of a frame, reproducible from its frame number
+ */
+static void fill_frame(std::vector<unsigned char>& buf, uint64_t frame_number) {
+	uint32_t x = (uint32_t)(frame_number * 2654435761u) | 1;
+	for (size_t i = 0; i < buf.size(); i += 4) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		memcpy(&buf[i], &x, 4);
+	}
+}
+
+/**
+ * Child: record frames until killed
+ */
+static void run_writer(const std::string& path) {
+	Recorder recorder(frame_size, 8);
+	recorder.m_checkpoint_ms = 50;
+
+	if (!recorder.open(path)) {
+		_exit(2);
+	}
+
+	std::vector<unsigned char> frame(frame_size);
+	for (uint64_t n = 1; ; n++) {
+		fill_frame(frame, n);
+		recorder.submit(frame.data(), frame.size(), n, n * 33.3);
+		std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	}
+}
+
+static bool read_header(int fd, uint64_t offset, uint64_t file_size, RecordHeader& h) {
+	return offset + sizeof(h) <= file_size && pread(fd, &h, sizeof(h), offset) == (ssize_t)sizeof(h) &&
+		h.magic == Recorder::MAGIC && h.header_size == sizeof(RecordHeader) &&
+		h.record_size % Recorder::RECORD_ALIGN == 0 && h.record_size >= sizeof(h) + h.size &&
+		offset + h.record_size <= file_size;
+}
+
+/**
+ * Check the index recovery wrote against the recording
+ */
+static bool verify(const std::string& path, size_t& records) {
+	int fd = open(path.c_str(), O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		std::cout << "cannot open " << path << std::endl;
+		return false;
+	}
+	uint64_t file_size = st.st_size;
+
+	FILE* f = fopen((path + ".idx").c_str(), "rb");
+	if (f == NULL) {
+		std::cout << "no index written" << std::endl;
+		close(fd);
+		return false;
+	}
+
+	std::vector<IndexEntry> entries;
+	IndexEntry e;
+	while (fread(&e, sizeof(e), 1, f) == 1) {
+		entries.push_back(e);
+	}
+	fclose(f);
+
+	bool ok = true;
+	if (entries.empty() || entries.back().type != Recorder::INDEX_CHECKPOINT ||
+		entries.back().frame_number != entries.size() - 1)
+	{
+		std::cout << "index does not end with a checkpoint covering it" << std::endl;
+		ok = false;
+	} else {
+		entries.pop_back();
+	}
+
+	std::vector<unsigned char> payload(frame_size);
+	std::vector<unsigned char> expected(frame_size);
+	std::set<uint64_t> indexed;
+	uint64_t end = 0;
+
+	for (size_t i = 0; ok && i < entries.size(); i++) {
+		const IndexEntry& ie = entries[i];
+		RecordHeader h;
+
+		if (ie.magic != Recorder::INDEX_MAGIC || ie.type != Recorder::INDEX_ENTRY ||
+			ie.checksum != record_checksum(&ie, offsetof(IndexEntry, checksum)))
+		{
+			std::cout << "index entry " << i << " is corrupt" << std::endl;
+			ok = false;
+		} else if (ie.offset < end) {
+			std::cout << "index entry " << i << " is out of order or overlaps" << std::endl;
+			ok = false;
+		} else if (!read_header(fd, ie.offset, file_size, h) || h.size != frame_size ||
+			h.frame_number != ie.frame_number || h.record_size != ie.record_size)
+		{
+			std::cout << "index entry " << i << " does not match the record at " << ie.offset << std::endl;
+			ok = false;
+		} else {
+			fill_frame(expected, h.frame_number);
+			if (pread(fd, payload.data(), h.size, ie.offset + sizeof(h)) != (ssize_t)h.size ||
+				record_checksum(payload.data(), h.size) != ie.payload_checksum ||
+				memcmp(payload.data(), expected.data(), h.size) != 0)
+			{
+				std::cout << "payload of frame " << h.frame_number << " is wrong" << std::endl;
+				ok = false;
+			}
+		}
+
+		end = ie.offset + ie.record_size;
+		indexed.insert(ie.offset);
+	}
+
+	// Every intact record in the file must have made it into the index
+	for (uint64_t offset = 0; ok && offset < file_size; offset += Recorder::RECORD_ALIGN) {
+		RecordHeader h;
+		if (indexed.count(offset) || !read_header(fd, offset, file_size, h)) {
+			continue;
+		}
+
+		std::vector<unsigned char> buf(h.size);
+		if (pread(fd, buf.data(), h.size, offset + sizeof(h)) == (ssize_t)h.size &&
+			record_checksum(buf.data(), h.size) == h.checksum)
+		{
+			std::cout << "intact record of frame " << h.frame_number << " at " << offset
+				<< " is missing from the index" << std::endl;
+			ok = false;
+		}
+	}
+
+	close(fd);
+	records = entries.size();
+	return ok;
+}
+
+int main(int argc, char** argv) {
+	int runs = argc > 1 ? atoi(argv[1]) : 10;
+	std::string dir = argc > 2 ? argv[2] : "/tmp";
+
+	std::mt19937 rng((unsigned int)time(NULL));
+	std::uniform_int_distribution<int> kill_after(20, 500);
+	int failed = 0;
+
+	for (int run = 0; run < runs; run++) {
+		std::string path = dir + "/recovery_test_" + std::to_string(getpid()) + "_" + std::to_string(run) + ".rec";
+		int ms = kill_after(rng);
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return 1;
+		}
+
+		if (pid == 0) {
+			run_writer(path);
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+		kill(pid, SIGKILL);
+
+		int status;
+		waitpid(pid, &status, 0);
+		if (WIFEXITED(status)) {
+			std::cout << "run " << run << ": writer failed to start" << std::endl;
+			failed++;
+			continue;
+		}
+
+		size_t records = 0;
+		bool ok = recover_recording(path) && verify(path, records);
+		std::cout << "run " << run << ": killed after " << ms << " ms, " << records << " records, "
+			<< (ok ? "ok" : "FAILED") << std::endl;
+
+		if (!ok) {
+			failed++;
+			continue;
+		}
+
+		unlink(path.c_str());
+		unlink((path + ".idx").c_str());
+	}
+
+	std::cout << runs - failed << " of " << runs << " runs passed" << std::endl;
+	return failed ? 1 : 0;
+}
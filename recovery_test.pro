@@ -0,0 +1,23 @@
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= app_bundle
+CONFIG -= qt
+
+TARGET = recovery_test
+
+SOURCES += \
+        recovery_test.cpp \
+        recorder.cpp \
+        recovery.cpp \
+        numa.cpp
+
+HEADERS += \
+        numa.h \
+        recorder.h \
+        recovery.h
+
+LIBS += -pthread -latomic
+
+# liburing, uncomment both lines when recording with io_uring
+# DEFINES += HAVE_LIBURING
+# LIBS += -luring
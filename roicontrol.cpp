@@ -0,0 +1,117 @@
+#include "roicontrol.h"
+
+#include <stdlib.h>
+#include <algorithm>
+
+RoiController::RoiController(int w, int h, const rs2::region_of_interest& target)
+	: m_min_blob_pixels(500), m_min_size(64), m_margin(16), m_lost_frames(30), m_hysteresis(16),
+	m_min_interval_ms(500), m_smoothing(0.2f),
+	m_w(w), m_h(h), m_target(target), m_sent(target),
+	m_frames_without_blob(0), m_ever_sent(false), m_sent_count(0), m_suppressed(0), m_held_back(false)
+{
+	m_x0 = (float)target.min_x;
+	m_y0 = (float)target.min_y;
+	m_x1 = (float)target.max_x;
+	m_y1 = (float)target.max_y;
+}
+
+void RoiController::clamp(float& x0, float& y0, float& x1, float& y1) const {
+	// Grow too small regions around their center
+	float min_w = (float)std::min(m_min_size, m_w);
+	float min_h = (float)std::min(m_min_size, m_h);
+
+	if (x1 - x0 < min_w) {
+		float c = (x0 + x1) * 0.5f;
+		x0 = c - min_w * 0.5f;
+		x1 = c + min_w * 0.5f;
+	}
+	if (y1 - y0 < min_h) {
+		float c = (y0 + y1) * 0.5f;
+		y0 = c - min_h * 0.5f;
+		y1 = c + min_h * 0.5f;
+	}
+
+	// Shift back inside the image, keeping the size
+	if (x0 < 0.0f) {
+		x1 -= x0;
+		x0 = 0.0f;
+	}
+	if (x1 > m_w - 1) {
+		x0 -= x1 - (m_w - 1);
+		x1 = (float)(m_w - 1);
+	}
+	if (y0 < 0.0f) {
+		y1 -= y0;
+		y0 = 0.0f;
+	}
+	if (y1 > m_h - 1) {
+		y0 -= y1 - (m_h - 1);
+		y1 = (float)(m_h - 1);
+	}
+
+	x0 = std::max(x0, 0.0f);
+	y0 = std::max(y0, 0.0f);
+}
+
+void RoiController::update(const std::vector<Blob>& blobs) {
+	float x0, y0, x1, y1;
+
+	if (!blobs.empty() && blobs[0].pixels >= m_min_blob_pixels) {
+		const Blob& b = blobs[0];
+		x0 = (float)(b.min_x - m_margin);
+		y0 = (float)(b.min_y - m_margin);
+		x1 = (float)(b.max_x + m_margin);
+		y1 = (float)(b.max_y + m_margin);
+		m_frames_without_blob = 0;
+	} else if (++m_frames_without_blob > m_lost_frames) {
+		x0 = (float)m_target.min_x;
+		y0 = (float)m_target.min_y;
+		x1 = (float)m_target.max_x;
+		y1 = (float)m_target.max_y;
+	} else {
+		// Briefly lost, e.g. the subject stopped moving: stay put
+		return;
+	}
+
+	clamp(x0, y0, x1, y1);
+
+	m_x0 += (x0 - m_x0) * m_smoothing;
+	m_y0 += (y0 - m_y0) * m_smoothing;
+	m_x1 += (x1 - m_x1) * m_smoothing;
+	m_y1 += (y1 - m_y1) * m_smoothing;
+}
+
+bool RoiController::take(std::chrono::steady_clock::time_point now, rs2::region_of_interest& out) {
+	rs2::region_of_interest r;
+	r.min_x = (int)(m_x0 + 0.5f);
+	r.min_y = (int)(m_y0 + 0.5f);
+	r.max_x = (int)(m_x1 + 0.5f);
+	r.max_y = (int)(m_y1 + 0.5f);
+
+	bool moved = abs(r.min_x - m_sent.min_x) > m_hysteresis || abs(r.min_y - m_sent.min_y) > m_hysteresis ||
+		abs(r.max_x - m_sent.max_x) > m_hysteresis || abs(r.max_y - m_sent.max_y) > m_hysteresis;
+
+	if (!moved) {
+		m_held_back = false;
+		return false;
+	}
+
+	if (m_ever_sent && now - m_last_sent < std::chrono::milliseconds(m_min_interval_ms)) {
+		if (!m_held_back) {
+			m_suppressed++;
+			m_held_back = true;
+		}
+		return false;
+	}
+
+	m_held_back = false;
+	m_last_sent = now;
+	m_ever_sent = true;
+	out = r;
+	return true;
+}
+
+void RoiController::confirm_sent(const rs2::region_of_interest& roi) {
+	m_sent = roi;
+	m_sent_count++;
+}
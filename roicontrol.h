@@ -0,0 +1,84 @@
+#ifndef ROICONTROL_H__
+#define ROICONTROL_H__
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+#include "blobs.h"
+
+/**
+ * Moves the auto exposure region of interest to follow the largest foreground
+ * blob, or back to a configured target region when there is none.
+ *
+ * The region is smoothed every frame but only handed out for sending when an
+ * edge moved by more than m_hysteresis pixels from the last sent region, and
+ * at most once every m_min_interval_ms, as each write is a USB control
+ * transfer that can stall the depth sensor.
+ */
+class RoiController {
+public:
+	/**
+	 * w, h: depth image size. target: region used without a blob.
+	 */
+	RoiController(int w, int h, const rs2::region_of_interest& target);
+
+	/**
+	 * Move the region towards the largest blob of at least m_min_blob_pixels,
+	 * blobs sorted largest first as from BlobExtractor
+	 */
+	void update(const std::vector<Blob>& blobs);
+
+	/**
+	 * The region to send if it moved far enough and the rate limit allows.
+	 * Returns false if nothing should be sent now. The rate limit starts
+	 * over either way once a region is handed out, but it only counts as
+	 * sent after confirm_sent().
+	 */
+	bool take(std::chrono::steady_clock::time_point now, rs2::region_of_interest& out);
+
+	/** Call once the camera accepted a region from take() */
+	void confirm_sent(const rs2::region_of_interest& roi);
+
+	/** Last region the camera accepted, the target before that */
+	const rs2::region_of_interest& sent() const { return m_sent; }
+
+	uint64_t sent_count() const { return m_sent_count; }
+	uint64_t suppressed() const { return m_suppressed; }
+
+	int m_min_blob_pixels;
+	int m_min_size;          // px, smallest region edge
+	int m_margin;            // px added around the blob
+	int m_lost_frames;       // frames without a blob before returning to the target
+	int m_hysteresis;        // px
+	int m_min_interval_ms;
+	float m_smoothing;       // 0..1, share of the distance moved per frame
+
+private:
+	void clamp(float& x0, float& y0, float& x1, float& y1) const;
+
+	int m_w;
+	int m_h;
+	rs2::region_of_interest m_target;
+	rs2::region_of_interest m_sent;
+
+	// smoothed region edges
+	float m_x0;
+	float m_y0;
+	float m_x1;
+	float m_y1;
+
+	int m_frames_without_blob;
+	bool m_ever_sent;
+	std::chrono::steady_clock::time_point m_last_sent;
+	uint64_t m_sent_count;
+
+	// moves held back by the rate limit; one held back move counts once
+	// however many frames it waits
+	uint64_t m_suppressed;
+	bool m_held_back;
+};
+
+#endif // ROICONTROL_H__
@@ -0,0 +1,151 @@
+#include "sensorstreams.h"
+
+#include <iostream>
+
+/**
+ * Find a stream profile on any sensor of dev. w / h are ignored for non-video
+ * profiles, fps <= 0 matches any rate. Returns false if nothing matched.
+ */
+static bool find_profile(const rs2::device& dev, rs2_stream stream, int index, int w, int h,
+	rs2_format format, int fps, rs2::sensor& sensor, rs2::stream_profile& profile)
+{
+	std::vector<rs2::sensor> sensors = dev.query_sensors();
+
+	for (size_t i = 0; i < sensors.size(); i++) {
+		std::vector<rs2::stream_profile> profiles = sensors[i].get_stream_profiles();
+
+		for (size_t j = 0; j < profiles.size(); j++) {
+			const rs2::stream_profile& p = profiles[j];
+
+			if (p.stream_type() != stream || p.format() != format) {
+				continue;
+			}
+			if (index >= 0 && p.stream_index() != index) {
+				continue;
+			}
+			if (fps > 0 && p.fps() != fps) {
+				continue;
+			}
+			if (p.is<rs2::video_stream_profile>()) {
+				rs2::video_stream_profile vp = p.as<rs2::video_stream_profile>();
+				if (vp.width() != w || vp.height() != h) {
+					continue;
+				}
+			}
+
+			sensor = sensors[i];
+			profile = p;
+			return true;
+		}
+	}
+
+	std::cout << "No " << rs2_stream_to_string(stream) << " " << index << " stream profile with "
+		<< rs2_format_to_string(format) << " " << w << "x" << h << " @ " << fps << " fps" << std::endl;
+	return false;
+}
+
+SensorStreams::SensorStreams(const rs2::device& dev, unsigned int queue_size)
+	: m_dev(dev), m_queue_size(queue_size), m_depth_queue(queue_size), m_color_queue(queue_size)
+{
+}
+
+SensorStreams::~SensorStreams() {
+	stop();
+}
+
+bool SensorStreams::add_depth(int w, int h, int fps, bool with_ir) {
+	rs2::stream_profile p;
+	if (!find_profile(m_dev, RS2_STREAM_DEPTH, -1, w, h, RS2_FORMAT_Z16, fps, m_depth_sensor, p)) {
+		return false;
+	}
+
+	m_depth_profiles.push_back(p);
+	m_depth_profile = p.as<rs2::video_stream_profile>();
+
+	if (with_ir) {
+		// IR comes from the same sensor and has to be opened together with depth
+		for (int index = 1; index <= 2; index++) {
+			rs2::sensor s;
+			if (!find_profile(m_dev, RS2_STREAM_INFRARED, index, w, h, RS2_FORMAT_Y8, fps, s, p)) {
+				return false;
+			}
+			m_depth_profiles.push_back(p);
+		}
+	}
+
+	return true;
+}
+
+bool SensorStreams::add_color(int w, int h, rs2_format format, int fps) {
+	rs2::stream_profile p;
+	if (!find_profile(m_dev, RS2_STREAM_COLOR, -1, w, h, format, fps, m_color_sensor, p)) {
+		return false;
+	}
+
+	m_color_profiles.push_back(p);
+	return true;
+}
+
+bool SensorStreams::add_motion(const std::function<void(rs2::frame)>& cb) {
+	rs2::stream_profile gyro, accel;
+	if (!find_profile(m_dev, RS2_STREAM_GYRO, -1, 0, 0, RS2_FORMAT_MOTION_XYZ32F, -1, m_motion_sensor, gyro) ||
+		!find_profile(m_dev, RS2_STREAM_ACCEL, -1, 0, 0, RS2_FORMAT_MOTION_XYZ32F, -1, m_motion_sensor, accel)) {
+		return false;
+	}
+
+	m_motion_profiles.push_back(gyro);
+	m_motion_profiles.push_back(accel);
+	m_motion_cb = cb;
+	return true;
+}
+
+void SensorStreams::start() {
+	if (!m_depth_profiles.empty()) {
+		// Room for every stream of the sensor, so IR frames do not push depth out
+		m_depth_queue = rs2::frame_queue(m_queue_size * (unsigned int)m_depth_profiles.size());
+
+		m_depth_sensor.open(m_depth_profiles);
+		if (m_depth_observer) {
+			m_depth_sensor.start([this](rs2::frame f) {
+				m_depth_observer(f);
+				m_depth_queue.enqueue(f);
+			});
+		} else {
+			m_depth_sensor.start(m_depth_queue);
+		}
+		m_started.push_back(m_depth_sensor);
+	}
+
+	if (!m_color_profiles.empty()) {
+		m_color_sensor.open(m_color_profiles);
+		m_color_sensor.start(m_color_queue);
+		m_started.push_back(m_color_sensor);
+	}
+
+	if (!m_motion_profiles.empty()) {
+		m_motion_sensor.open(m_motion_profiles);
+		m_motion_sensor.start(m_motion_cb);
+		m_started.push_back(m_motion_sensor);
+	}
+}
+
+void SensorStreams::stop() {
+	for (size_t i = 0; i < m_started.size(); i++) {
+		try {
+			m_started[i].stop();
+			m_started[i].close();
+		} catch (const rs2::error& e) {
+			std::cout << "RealSense error calling " << e.get_failed_function()
+				<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+				" when stopping sensor." << std::endl;
+		}
+	}
+
+	m_started.clear();
+
+	rs2::frame f;
+	while (m_depth_queue.poll_for_frame(&f)) {
+	}
+	while (m_color_queue.poll_for_frame(&f)) {
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef SENSORSTREAMS_H__
+#define SENSORSTREAMS_H__
+
+#include <functional>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+/**
+ * Streams opened directly on the device sensors instead of through
+ * rs2::pipeline. There is no syncer between the streams: depth (and IR) and
+ * color each get their own rs2::frame_queue and arrive at their own rate.
+ *
+ * queue_size is per stream. Depth and IR come from one sensor and share its
+ * queue, which holds queue_size frames of each of them.
+ */
+class SensorStreams {
+public:
+	SensorStreams(const rs2::device& dev, unsigned int queue_size);
+	virtual ~SensorStreams();
+
+	/**
+	 * Select Z16 depth, optionally with Y8 IR 1 and 2, on the depth sensor.
+	 * Returns false if the device has no matching profiles.
+	 */
+	bool add_depth(int w, int h, int fps, bool with_ir);
+
+	bool add_color(int w, int h, rs2_format format, int fps);
+
+	/**
+	 * Gyro and accel, delivered to cb on the sensor's thread
+	 */
+	bool add_motion(const std::function<void(rs2::frame)>& cb);
+
+	/**
+	 * Called on the sensor's thread with every depth / IR frame before it is
+	 * queued. Set before start().
+	 */
+	void set_depth_observer(const std::function<void(const rs2::frame&)>& cb) { m_depth_observer = cb; }
+
+	/**
+	 * Open and start every selected sensor. Throws rs2::error on failure.
+	 */
+	void start();
+
+	/**
+	 * Stop and close the sensors, then drop queued frames
+	 */
+	void stop();
+
+	const rs2::frame_queue& depth_queue() const { return m_depth_queue; }
+	const rs2::frame_queue& color_queue() const { return m_color_queue; }
+	rs2::video_stream_profile depth_profile() const { return m_depth_profile; }
+
+private:
+	rs2::device m_dev;
+	unsigned int m_queue_size;
+	rs2::frame_queue m_depth_queue;
+	rs2::frame_queue m_color_queue;
+	rs2::video_stream_profile m_depth_profile;
+
+	rs2::sensor m_depth_sensor;
+	rs2::sensor m_color_sensor;
+	rs2::sensor m_motion_sensor;
+	std::vector<rs2::stream_profile> m_depth_profiles;
+	std::vector<rs2::stream_profile> m_color_profiles;
+	std::vector<rs2::stream_profile> m_motion_profiles;
+	std::function<void(rs2::frame)> m_motion_cb;
+	std::function<void(const rs2::frame&)> m_depth_observer;
+	std::vector<rs2::sensor> m_started;
+};
+
+#endif // SENSORSTREAMS_H__
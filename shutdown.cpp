@@ -0,0 +1,173 @@
+#include "shutdown.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef WIN32
+#include <Windows.h>
+#else
+#include <csignal>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// The signal handlers need a way back to the coordinator
+static Shutdown* g_shutdown = NULL;
+
+#ifdef WIN32
+static BOOL WINAPI console_handler(DWORD fdwCtrlType) {
+	if (fdwCtrlType != CTRL_C_EVENT && fdwCtrlType != CTRL_CLOSE_EVENT) {
+		return FALSE;
+	}
+
+	if (g_shutdown) {
+		if (g_shutdown->requested()) {
+			ExitProcess(1);
+		}
+		g_shutdown->request();
+	}
+
+	return TRUE;
+}
+#else
+static void signal_handler(int sig) {
+	(void)sig;
+
+	if (g_shutdown) {
+		if (g_shutdown->requested()) {
+			_exit(1);
+		}
+		g_shutdown->request();
+	}
+}
+#endif
+
+Shutdown::Shutdown() {
+	m_requested.store(false);
+	m_pipe[0] = -1;
+	m_pipe[1] = -1;
+
+#ifndef WIN32
+	if (pipe(m_pipe) == 0) {
+		for (int i = 0; i < 2; i++) {
+			fcntl(m_pipe[i], F_SETFL, fcntl(m_pipe[i], F_GETFL) | O_NONBLOCK);
+			fcntl(m_pipe[i], F_SETFD, FD_CLOEXEC);
+		}
+	} else {
+		std::cout << "failed creating shutdown pipe, shutdown cannot be polled" << std::endl;
+		m_pipe[0] = -1;
+		m_pipe[1] = -1;
+	}
+#endif
+}
+
+Shutdown::~Shutdown() {
+	if (g_shutdown == this) {
+		g_shutdown = NULL;
+	}
+
+#ifndef WIN32
+	for (int i = 0; i < 2; i++) {
+		if (m_pipe[i] >= 0) {
+			close(m_pipe[i]);
+		}
+	}
+#endif
+}
+
+void Shutdown::install_signal_handlers() {
+	g_shutdown = this;
+
+#ifdef WIN32
+	SetConsoleCtrlHandler(console_handler, TRUE);
+#else
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+#endif
+}
+
+void Shutdown::request() {
+	m_requested.store(true);
+
+#ifndef WIN32
+	if (m_pipe[1] >= 0) {
+		char c = 1;
+		ssize_t ret = write(m_pipe[1], &c, 1);
+		(void)ret;
+	}
+#endif
+}
+
+void Shutdown::add(const std::string& name, const std::function<void()>& stop) {
+	Component c;
+	c.name = name;
+	c.stop = stop;
+	m_components.push_back(c);
+}
+
+bool Shutdown::run(int deadline_ms) {
+	// Shared with the stop threads, which may outlive this call if they hang
+	struct State {
+		std::mutex mutex;
+		std::condition_variable cv;
+		std::vector<int64_t> elapsed_ms;
+		size_t finished;
+	};
+
+	std::shared_ptr<State> state = std::make_shared<State>();
+	state->elapsed_ms.assign(m_components.size(), -1);
+	state->finished = 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < m_components.size(); i++) {
+		std::function<void()> stop = m_components[i].stop;
+		std::string name = m_components[i].name;
+
+		threads.push_back(std::thread([state, stop, name, i, start]() {
+			try {
+				stop();
+			} catch (const std::exception& e) {
+				std::cout << "shutdown: " << name << " failed: " << e.what() << std::endl;
+			}
+
+			std::lock_guard<std::mutex> lock(state->mutex);
+			state->elapsed_ms[i] = std::chrono::duration_cast<std::chrono::milliseconds>(
+				std::chrono::steady_clock::now() - start).count();
+			state->finished++;
+			state->cv.notify_all();
+		}));
+	}
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	bool all = state->cv.wait_until(lock, start + std::chrono::milliseconds(deadline_ms),
+		[&] { return state->finished == m_components.size(); });
+
+	for (size_t i = 0; i < m_components.size(); i++) {
+		if (state->elapsed_ms[i] >= 0) {
+			std::cout << "shutdown: " << m_components[i].name << " stopped in "
+				<< state->elapsed_ms[i] << " ms" << std::endl;
+		} else {
+			std::cout << "shutdown: " << m_components[i].name << " did not stop within "
+				<< deadline_ms << " ms" << std::endl;
+		}
+	}
+
+	lock.unlock();
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		if (all) {
+			threads[i].join();
+		} else {
+			threads[i].detach();
+		}
+	}
+
+	m_components.clear();
+	return all;
+}
@@ -0,0 +1,61 @@
+#ifndef SHUTDOWN_H__
+#define SHUTDOWN_H__
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+/**
+ * Coordinates a bounded time shutdown.
+ *
+ * request() only touches a lock-free atomic flag and writes to a self-pipe,
+ * so it is safe to call from signal handlers. Threads blocked in poll() on
+ * fd(), like the event trigger listener, wake up immediately; frame waits,
+ * which have no descriptor, check requested() every few ms.
+ *
+ * Components register a stop function with add(). run() calls them all in
+ * parallel and waits until they finish or a deadline passes, reporting how
+ * long each one took.
+ */
+class Shutdown {
+public:
+	Shutdown();
+	virtual ~Shutdown();
+
+	/**
+	 * Route SIGINT / SIGTERM (console control events on Windows) to request().
+	 * A second signal while shutting down exits immediately.
+	 */
+	void install_signal_handlers();
+
+	/** Async-signal-safe */
+	void request();
+
+	bool requested() const { return m_requested.load(); }
+
+	/**
+	 * Readable once shutdown is requested. -1 on Windows.
+	 */
+	int fd() const { return m_pipe[0]; }
+
+	void add(const std::string& name, const std::function<void()>& stop);
+
+	/**
+	 * Run every stop function in parallel. Returns false if some did not
+	 * finish within deadline_ms; those threads are left running detached.
+	 */
+	bool run(int deadline_ms);
+
+private:
+	struct Component {
+		std::string name;
+		std::function<void()> stop;
+	};
+
+	std::atomic<bool> m_requested;
+	int m_pipe[2];
+	std::vector<Component> m_components;
+};
+
+#endif // SHUTDOWN_H__
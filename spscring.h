@@ -0,0 +1,66 @@
+#ifndef SPSCRING_H__
+#define SPSCRING_H__
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/**
+ * Lock-free ring for exactly one producer and one consumer thread.
+ * Capacity is rounded up to a power of two.
+ */
+template <class T>
+class SpscRing {
+public:
+	SpscRing(size_t capacity) {
+		size_t n = 1;
+		while (n < capacity) {
+			n <<= 1;
+		}
+
+		m_items.resize(n);
+		m_mask = n - 1;
+		m_head.store(0);
+		m_tail.store(0);
+	}
+
+	/**
+	 * Producer side. Returns false if the ring is full.
+	 */
+	bool push(const T& item) {
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head - m_tail.load(std::memory_order_acquire) > m_mask) {
+			return false;
+		}
+
+		m_items[head & m_mask] = item;
+		m_head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	 * Consumer side. Returns false if the ring is empty.
+	 */
+	bool pop(T& item) {
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		if (tail == m_head.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		item = m_items[tail & m_mask];
+		m_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t capacity() const { return m_items.size(); }
+
+private:
+	std::vector<T> m_items;
+	size_t m_mask;
+
+	// producer and consumer indices on separate cache lines
+	alignas(64) std::atomic<size_t> m_head;
+	alignas(64) std::atomic<size_t> m_tail;
+};
+
+#endif // SPSCRING_H__
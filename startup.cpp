@@ -0,0 +1,327 @@
+#include "startup.h"
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <thread>
+
+#include <librealsense2/rs_advanced_mode.hpp>
+
+typedef std::chrono::steady_clock steady_clock;
+
+StartupProfiler::StartupProfiler() {
+	m_t0 = steady_clock::now();
+}
+
+static double ms_between(steady_clock::time_point a, steady_clock::time_point b) {
+	return std::chrono::duration<double, std::milli>(b - a).count();
+}
+
+void StartupProfiler::add(const std::string& name, steady_clock::time_point start) {
+	Step s;
+	s.name = name;
+	s.start_ms = ms_between(m_t0, start);
+	s.duration_ms = ms_between(start, steady_clock::now());
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_steps.push_back(s);
+}
+
+double StartupProfiler::elapsed_ms() const {
+	return ms_between(m_t0, steady_clock::now());
+}
+
+void StartupProfiler::print() const {
+	std::vector<Step> steps;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		steps = m_steps;
+	}
+
+	std::stable_sort(steps.begin(), steps.end(), [](const Step& a, const Step& b) {
+		return a.start_ms < b.start_ms;
+	});
+
+	std::cout << "startup steps:" << std::endl;
+	for (size_t i = 0; i < steps.size(); i++) {
+		std::cout << "  " << steps[i].name << ": " << (int)steps[i].duration_ms
+			<< " ms (at " << (int)steps[i].start_ms << " ms)" << std::endl;
+	}
+	std::cout << "  total: " << (int)elapsed_ms() << " ms" << std::endl;
+}
+
+/**
+ * Collect "key": value pairs of a settings JSON. Nested objects, as written by
+ * newer librealsense versions, are flattened.
+ */
+static std::map<std::string, std::string> json_values(const std::string& json) {
+	std::map<std::string, std::string> values;
+	size_t i = 0;
+
+	while (i < json.size()) {
+		size_t key_start = json.find('"', i);
+		if (key_start == std::string::npos) {
+			break;
+		}
+
+		size_t key_end = json.find('"', key_start + 1);
+		if (key_end == std::string::npos) {
+			break;
+		}
+
+		size_t colon = json.find_first_not_of(" \t\r\n", key_end + 1);
+		if (colon == std::string::npos || json[colon] != ':') {
+			i = key_end + 1;
+			continue;
+		}
+
+		size_t value_start = json.find_first_not_of(" \t\r\n", colon + 1);
+		if (value_start == std::string::npos) {
+			break;
+		}
+
+		std::string key = json.substr(key_start + 1, key_end - key_start - 1);
+
+		if (json[value_start] == '{') {
+			i = value_start + 1;
+		} else if (json[value_start] == '"') {
+			size_t value_end = json.find('"', value_start + 1);
+			if (value_end == std::string::npos) {
+				break;
+			}
+			values[key] = json.substr(value_start + 1, value_end - value_start - 1);
+			i = value_end + 1;
+		} else {
+			size_t value_end = json.find_first_of(",}", value_start);
+			if (value_end == std::string::npos) {
+				value_end = json.size();
+			}
+			std::string v = json.substr(value_start, value_end - value_start);
+			v.erase(v.find_last_not_of(" \t\r\n") + 1);
+			values[key] = v;
+			i = value_end;
+		}
+	}
+
+	return values;
+}
+
+static bool same_value(const std::string& a, const std::string& b) {
+	if (a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+		return tolower((unsigned char)x) == tolower((unsigned char)y);
+	})) {
+		return true;
+	}
+
+	// The camera reports some values rounded differently than the preset has them
+	char* end_a;
+	char* end_b;
+	double da = strtod(a.c_str(), &end_a);
+	double db = strtod(b.c_str(), &end_b);
+	if (end_a == a.c_str() || *end_a != '\0' || end_b == b.c_str() || *end_b != '\0') {
+		return false;
+	}
+
+	return fabs(da - db) <= 1e-4 * std::max(1.0, fabs(da));
+}
+
+/**
+ * True if every setting of the preset which the camera reports has the preset's value
+ */
+static bool settings_match(rs400::advanced_mode& adv, const char* json) {
+	std::map<std::string, std::string> wanted = json_values(json);
+	std::map<std::string, std::string> current = json_values(adv.serialize_json());
+	int compared = 0;
+
+	for (auto it = wanted.begin(); it != wanted.end(); ++it) {
+		auto cur = current.find(it->first);
+		if (cur == current.end()) {
+			continue;
+		}
+
+		if (!same_value(it->second, cur->second)) {
+			return false;
+		}
+		compared++;
+	}
+
+	// Nothing in common means the dump is in a format not understood here
+	return compared > 0;
+}
+
+/**
+ * Spot check of a preset against the camera: a handful of settings which are
+ * cheap to read back, instead of serializing all of them
+ */
+static bool settings_sample_match(const rs2::device& dev, const char* json) {
+	std::map<std::string, std::string> wanted = json_values(json);
+	int compared = 0;
+	bool match = true;
+
+	auto check = [&](const char* key, double value) {
+		auto it = wanted.find(key);
+		if (it == wanted.end()) {
+			return;
+		}
+
+		compared++;
+		if (!same_value(it->second, std::to_string(value))) {
+			std::cout << "camera has " << key << " " << value << ", preset " << it->second << std::endl;
+			match = false;
+		}
+	};
+
+	rs400::advanced_mode adv(dev);
+	STDepthControlGroup dc = adv.get_depth_control();
+	check("param-medianthreshold", dc.deepSeaMedianThreshold);
+	check("param-minscorethresha", dc.scoreThreshA);
+	check("param-maxscorethreshb", dc.scoreThreshB);
+	check("param-texturedifferencethresh", dc.textureDifferenceThreshold);
+	check("param-neighborthresh", dc.deepSeaNeighborThreshold);
+	check("param-leftrightthreshold", dc.lrAgreeThreshold);
+
+	rs2::depth_sensor depth = dev.first<rs2::depth_sensor>();
+	if (depth.supports(RS2_OPTION_LASER_POWER)) {
+		check("controls-laserpower", depth.get_option(RS2_OPTION_LASER_POWER));
+	}
+	if (depth.supports(RS2_OPTION_GAIN)) {
+		check("controls-depth-gain", depth.get_option(RS2_OPTION_GAIN));
+	}
+
+	return match && compared > 0;
+}
+
+/**
+ * Wait up to timeout_ms for the camera with the given serial number to show up
+ * again in advanced mode. It may still be listed in its old state for a while.
+ */
+static bool find_advanced_device(rs2::context& context, const std::string& serial, int timeout_ms, rs2::device& dev) {
+	steady_clock::time_point start = steady_clock::now();
+
+	while (ms_between(start, steady_clock::now()) < timeout_ms) {
+		rs2::device_list devs = context.query_devices();
+		for (uint32_t i = 0; i < devs.size(); i++) {
+			try {
+				rs2::device d = devs[i];
+				if (serial == d.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER) &&
+					rs400::advanced_mode(d).is_enabled()) {
+					dev = d;
+					return true;
+				}
+			} catch (const rs2::error&) {
+				// still booting
+			}
+		}
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	}
+
+	return false;
+}
+
+bool prepare_device(rs2::context& context, rs2::device& dev, const char* json, StartupProfiler& profiler,
+	DeviceStateCache* cache)
+{
+	std::string serial = dev.get_info(RS2_CAMERA_INFO_SERIAL_NUMBER);
+	std::string firmware = dev.supports(RS2_CAMERA_INFO_FIRMWARE_VERSION) ?
+		dev.get_info(RS2_CAMERA_INFO_FIRMWARE_VERSION) : "unknown";
+	uint64_t preset_hash = DeviceStateCache::hash(json);
+	steady_clock::time_point t = steady_clock::now();
+
+	rs400::advanced_mode adv(dev);
+
+	uint64_t cached_hash;
+	if (cache && cache->lookup(serial, firmware, cached_hash) && cached_hash == preset_hash) {
+		bool match = false;
+		try {
+			match = adv.is_enabled() && settings_sample_match(dev, json);
+		} catch (const rs2::error& e) {
+			std::cout << "RealSense error calling " << e.get_failed_function()
+				<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+				" when verifying cached camera state." << std::endl;
+		}
+
+		if (match) {
+			std::cout << serial << ": settings match the state cache" << std::endl;
+			profiler.add(serial + " state cache check", t);
+			return true;
+		}
+
+		std::cout << serial << ": camera does not match the state cache" << std::endl;
+		cache->forget(serial, firmware);
+	}
+
+	if (!adv.is_enabled()) {
+		std::cout << serial << ": advanced mode is not enabled -> enabling it" << std::endl;
+
+		adv.toggle_advanced_mode(true);
+
+		// The camera reboots into advanced mode
+		if (!find_advanced_device(context, serial, 10000, dev)) {
+			std::cout << serial << ": camera did not come back after enabling advanced mode" << std::endl;
+			return false;
+		}
+
+		std::cout << serial << ": finished toggling advanced mode" << std::endl;
+		profiler.add(serial + " advanced mode toggle", t);
+	} else {
+		std::cout << serial << ": advanced mode is already enabled" << std::endl;
+	}
+
+	t = steady_clock::now();
+
+	try {
+		rs400::advanced_mode adv2(dev);
+		if (settings_match(adv2, json)) {
+			std::cout << serial << ": settings JSON already applied" << std::endl;
+			profiler.add(serial + " settings compare", t);
+		} else {
+			adv2.load_json(json);
+			profiler.add(serial + " load_json", t);
+		}
+
+		if (cache) {
+			cache->store(serial, firmware, preset_hash);
+		}
+	} catch (const rs2::error& e) {
+		std::cout << "RealSense error calling " << e.get_failed_function()
+			<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+			" when loading settings JSON." << std::endl;
+	}
+
+	return true;
+}
+
+void prepare_devices(rs2::context& context, std::vector<rs2::device>& devs, const char* json,
+	StartupProfiler& profiler, DeviceStateCache* cache)
+{
+	std::vector<char> ok(devs.size(), 0);
+	std::vector<std::thread> threads;
+
+	for (size_t i = 0; i < devs.size(); i++) {
+		threads.push_back(std::thread([&, i]() {
+			try {
+				ok[i] = prepare_device(context, devs[i], json, profiler, cache);
+			} catch (const rs2::error& e) {
+				std::cout << "RealSense error calling " << e.get_failed_function()
+					<< "(" << e.get_failed_args() << "):\n " << e.what() <<
+					" when preparing camera." << std::endl;
+			}
+		}));
+	}
+
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+
+	std::vector<rs2::device> ready;
+	for (size_t i = 0; i < devs.size(); i++) {
+		if (ok[i]) {
+			ready.push_back(devs[i]);
+		}
+	}
+	devs.swap(ready);
+}
@@ -0,0 +1,71 @@
+#ifndef STARTUP_H__
+#define STARTUP_H__
+
+#include <stddef.h>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <librealsense2/rs.hpp>
+
+#include "devicecache.h"
+
+/**
+ * Wall clock time of each startup step, measured from construction.
+ * Steps may be recorded from several threads.
+ */
+class StartupProfiler {
+public:
+	StartupProfiler();
+
+	/**
+	 * Record a step which started at start and ends now
+	 */
+	void add(const std::string& name, std::chrono::steady_clock::time_point start);
+
+	/** ms since construction */
+	double elapsed_ms() const;
+
+	/**
+	 * Print every step, ordered by start time, with the total
+	 */
+	void print() const;
+
+private:
+	struct Step {
+		std::string name;
+		double start_ms;
+		double duration_ms;
+	};
+
+	std::chrono::steady_clock::time_point m_t0;
+	mutable std::mutex m_mutex;
+	std::vector<Step> m_steps;
+};
+
+/**
+ * Bring a camera into advanced mode with the given settings JSON applied.
+ *
+ * Advanced mode is only toggled if it is off, as toggling reboots the camera.
+ * The JSON is only loaded if the camera's current settings differ from it.
+ * After a toggle the camera is looked up again by serial number, as the old
+ * handle is gone; dev is replaced with the new one.
+ *
+ * With a cache, a camera recorded as already having this preset is only
+ * verified by reading back a few settings instead of the full comparison.
+ * If those differ, the camera is prepared as if it was not cached.
+ *
+ * Returns false if the camera did not come back after the toggle.
+ */
+bool prepare_device(rs2::context& context, rs2::device& dev, const char* json, StartupProfiler& profiler,
+	DeviceStateCache* cache = NULL);
+
+/**
+ * Run prepare_device() for every camera in parallel. Cameras which failed
+ * are removed from devs.
+ */
+void prepare_devices(rs2::context& context, std::vector<rs2::device>& devs, const char* json,
+	StartupProfiler& profiler, DeviceStateCache* cache = NULL);
+
+#endif // STARTUP_H__
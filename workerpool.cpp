@@ -0,0 +1,97 @@
+#include "workerpool.h"
+
+#include "numa.h"
+
+WorkerPool::WorkerPool(int threads, int numa_node) {
+	m_fn = NULL;
+	m_next = 0;
+	m_jobs = 0;
+	m_running = 0;
+	m_generation = 0;
+	m_quit = false;
+
+	if (threads <= 0) {
+		threads = std::thread::hardware_concurrency();
+		if (numa_node >= 0) {
+			threads /= numa_node_count();
+		}
+	}
+
+	for (int i = 1; i < threads; i++) {
+		m_threads.push_back(std::thread(&WorkerPool::worker_main, this, numa_node));
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_quit = true;
+	}
+
+	m_cv_work.notify_all();
+
+	for (size_t i = 0; i < m_threads.size(); i++) {
+		m_threads[i].join();
+	}
+}
+
+/**
+ * Claims and runs jobs until none are left. Called with lock held,
+ * the lock is released while a job runs.
+ */
+void WorkerPool::run_jobs(std::unique_lock<std::mutex>& lock) {
+	while (m_next < m_jobs) {
+		int job = m_next++;
+		m_running++;
+
+		lock.unlock();
+		(*m_fn)(job);
+		lock.lock();
+
+		m_running--;
+	}
+
+	if (m_running == 0) {
+		m_cv_done.notify_all();
+	}
+}
+
+void WorkerPool::worker_main(int numa_node) {
+	numa_pin_current_thread(numa_node);
+
+	uint64_t seen = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true) {
+		m_cv_work.wait(lock, [&] { return m_quit || m_generation != seen; });
+
+		if (m_quit) {
+			return;
+		}
+
+		seen = m_generation;
+		run_jobs(lock);
+	}
+}
+
+void WorkerPool::parallel_for(int jobs, const std::function<void(int)>& fn) {
+	if (jobs <= 0) {
+		return;
+	}
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_fn = &fn;
+	m_next = 0;
+	m_jobs = jobs;
+	m_generation++;
+
+	if (jobs > 1) {
+		m_cv_work.notify_all();
+	}
+
+	run_jobs(lock);
+	m_cv_done.wait(lock, [&] { return m_next >= m_jobs && m_running == 0; });
+
+	m_fn = NULL;
+	m_jobs = 0;
+}
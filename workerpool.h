@@ -0,0 +1,52 @@
+#ifndef WORKERPOOL_H__
+#define WORKERPOOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of threads for splitting per-frame work into parallel jobs.
+ * Threads are created once and sleep between frames, so stages running at
+ * camera frame rate do not pay for thread creation.
+ */
+class WorkerPool {
+public:
+	/**
+	 * Creates threads - 1 workers, the thread calling parallel_for() is the
+	 * last one. threads <= 0 uses one thread per core, of numa_node if given.
+	 * Workers are pinned to the CPUs of numa_node if it is >= 0.
+	 */
+	WorkerPool(int threads, int numa_node = -1);
+	virtual ~WorkerPool();
+
+	/** Amount of threads running jobs, including the caller */
+	int size() const { return (int)m_threads.size() + 1; }
+
+	/**
+	 * Call fn(0) ... fn(jobs - 1) from the pool threads and the calling thread.
+	 * Returns once every job has finished. Not reentrant.
+	 */
+	void parallel_for(int jobs, const std::function<void(int)>& fn);
+
+private:
+	void worker_main(int numa_node);
+	void run_jobs(std::unique_lock<std::mutex>& lock);
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_mutex;
+	std::condition_variable m_cv_work;
+	std::condition_variable m_cv_done;
+	const std::function<void(int)>* m_fn;
+	int m_next;
+	int m_jobs;
+	int m_running;
+	uint64_t m_generation;
+	bool m_quit;
+};
+
+#endif // WORKERPOOL_H__